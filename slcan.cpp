@@ -0,0 +1,693 @@
+/* SPDX-License-Identifier: (GPL-2.0-only OR BSD-3-Clause) */
+/*
+ * slcan.cpp - SLCAN protocol library
+ */
+
+#include "slcan.h"
+
+#include <iostream>
+#include <sstream>
+#include <cctype>
+#include <cstdio>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Every length maps to the smallest DLC that holds it
+constexpr bool dlc_tables_match(int n)
+{
+    return n > 64 || (dlc_to_len[len_to_dlc[n]] >= n && (len_to_dlc[n] == 0 || dlc_to_len[len_to_dlc[n] - 1] < n) &&
+                      dlc_tables_match(n + 1));
+}
+static_assert(dlc_tables_match(0), "len_to_dlc does not match dlc_to_len");
+static_assert(hex_table.value['f'] == 15 && hex_table.value['G'] == 0xFF, "hex_table is broken");
+
+#ifdef __SSE2__
+// Converts 16 ASCII hex digits to nibble values, returns false if any of
+// them is not a hex digit
+static inline bool sse2_hex_nibbles(__m128i v, __m128i &nibbles)
+{
+    const __m128i digit = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    const __m128i is_digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                           _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    const __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    const __m128i alpha = _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10));
+    const __m128i is_alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                           _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+
+    nibbles = _mm_or_si128(_mm_and_si128(digit, is_digit), _mm_and_si128(alpha, is_alpha));
+    return _mm_movemask_epi8(_mm_or_si128(is_digit, is_alpha)) == 0xFFFF;
+}
+
+// Joins the high and low nibbles of each digit pair into one byte per 16 bit lane
+static inline __m128i sse2_join_nibbles(__m128i nibbles)
+{
+    const __m128i hi = _mm_and_si128(nibbles, _mm_set1_epi16(0x00FF));
+    const __m128i lo = _mm_srli_epi16(nibbles, 8);
+    return _mm_or_si128(_mm_slli_epi16(hi, 4), lo);
+}
+
+// Decodes 16 bytes from 32 hex digits
+static inline bool sse2_decode_hex16(const char *in, uint8_t *out)
+{
+    __m128i a, b;
+    bool ok = sse2_hex_nibbles(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in)), a);
+    ok &= sse2_hex_nibbles(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 16)), b);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out),
+                     _mm_packus_epi16(sse2_join_nibbles(a), sse2_join_nibbles(b)));
+    return ok;
+}
+#endif
+
+static inline bool decode_payload(const char *in, uint8_t *out, size_t n)
+{
+    bool ok = true;
+#ifdef __SSE2__
+    // CAN FD payloads of 16 bytes and more go through SSE2 in 16 byte blocks
+    for (; n >= 16; n -= 16, in += 32, out += 16)
+    {
+        ok &= sse2_decode_hex16(in, out);
+    }
+#endif
+    return decode_hex_bytes(in, out, n) && ok;
+}
+
+bool decode_slcan_frame(const char *s, size_t len, CanFrame &frame)
+{
+    if (len < 5)
+    {
+        return false;
+    }
+
+    uint8_t flags;
+    switch (s[0])
+    {
+    case 't':
+        flags = 0;
+        break;
+    case 'T':
+        flags = CAN_FLAG_EXT;
+        break;
+    case 'r':
+        flags = CAN_FLAG_RTR;
+        break;
+    case 'R':
+        flags = CAN_FLAG_RTR | CAN_FLAG_EXT;
+        break;
+    case 'd':
+        flags = CAN_FLAG_FDF;
+        break;
+    case 'D':
+        flags = CAN_FLAG_FDF | CAN_FLAG_EXT;
+        break;
+    case 'b':
+        flags = CAN_FLAG_FDF | CAN_FLAG_BRS;
+        break;
+    case 'B':
+        flags = CAN_FLAG_FDF | CAN_FLAG_BRS | CAN_FLAG_EXT;
+        break;
+    default:
+        return false;
+    }
+
+    // ID digits, the DLC digit is validated together with them
+    size_t id_digits = (flags & CAN_FLAG_EXT) ? 8 : 3;
+    if (len < 1 + id_digits + 1)
+    {
+        return false;
+    }
+
+    uint32_t id = 0;
+    uint8_t bad = 0;
+    for (size_t i = 1; i <= id_digits; i++)
+    {
+        uint8_t v = hex_table.value[(uint8_t)s[i]];
+        bad |= v;
+        id = (id << 4) | (v & 0x0F);
+    }
+    uint8_t dlc = hex_table.value[(uint8_t)s[1 + id_digits]];
+    bad |= dlc;
+    if (bad & 0xF0)
+    {
+        return false;
+    }
+
+    // Classic frames carry at most 8 bytes whatever the DLC says
+    uint8_t data_len = dlc_to_len[dlc];
+    if (!(flags & CAN_FLAG_FDF) && data_len > 8)
+    {
+        data_len = 8;
+    }
+
+    frame.id = id;
+    frame.dlc = dlc;
+    frame.len = data_len;
+
+    // RTR frames have a DLC but no data bytes on the wire
+    size_t pos = 1 + id_digits + 1;
+    size_t wire_len = (flags & CAN_FLAG_RTR) ? 0 : data_len;
+    if (len < pos + 2 * wire_len)
+    {
+        return false;
+    }
+    if (wire_len > 0 && !decode_payload(s + pos, frame.data, wire_len))
+    {
+        return false;
+    }
+    pos += 2 * wire_len;
+
+    // Optional ESI marker
+    if (pos < len && s[pos] == 'S')
+    {
+        flags |= CAN_FLAG_ESI;
+        pos++;
+    }
+
+    frame.flags = flags;
+    return pos == len;
+}
+
+size_t slcan_tx_frame_len(const char *s, size_t len)
+{
+    if (len < 2)
+    {
+        return 0;
+    }
+
+    bool fd;
+    switch (s[0])
+    {
+    case 't':
+    case 'T':
+        fd = false;
+        break;
+    case 'd':
+    case 'D':
+    case 'b':
+    case 'B':
+        fd = true;
+        break;
+    default:
+        return 0;
+    }
+    size_t id_digits = (s[0] >= 'a') ? 3 : 8; // Lower case: 11 bit ID
+
+    if (len < id_digits + 2)
+    {
+        return 0;
+    }
+    uint8_t dlc = hex_table.value[(uint8_t)s[id_digits + 1]];
+    if (dlc & 0xF0)
+    {
+        return 0;
+    }
+    size_t data_len = fd ? dlc_to_len[dlc] : std::min<size_t>(dlc, 8);
+    return id_digits + 2 + 2 * data_len;
+}
+
+size_t format_candump_line(const CanFrame &frame, int64_t wall_offset_ns, const char *iface, char *out)
+{
+    uint64_t wall_ns = frame.timestamp_ns + wall_offset_ns;
+    int n = sprintf(out, "(%010llu.%06llu) %s ", (unsigned long long)(wall_ns / 1000000000ull),
+                    (unsigned long long)(wall_ns % 1000000000ull / 1000), iface);
+    char *p = out + n;
+
+    int id_digits = (frame.flags & CAN_FLAG_EXT) ? 8 : 3;
+    for (int i = id_digits - 1; i >= 0; i--)
+    {
+        *p++ = hex_upper[(frame.id >> (4 * i)) & 0x0F];
+    }
+    *p++ = '#';
+
+    if (frame.flags & CAN_FLAG_RTR)
+    {
+        *p++ = 'R';
+        if (frame.len > 0)
+            *p++ = '0' + frame.len;
+    }
+    else
+    {
+        if (frame.flags & CAN_FLAG_FDF)
+        {
+            // CAN FD: ##<flags>, 1 = BRS, 2 = ESI
+            *p++ = '#';
+            *p++ = hex_upper[((frame.flags & CAN_FLAG_BRS) ? 1 : 0) | ((frame.flags & CAN_FLAG_ESI) ? 2 : 0)];
+        }
+        for (int i = 0; i < frame.len; i++)
+        {
+            *p++ = hex_upper[frame.data[i] >> 4];
+            *p++ = hex_upper[frame.data[i] & 0x0F];
+        }
+    }
+    *p++ = '\n';
+    return p - out;
+}
+
+bool parse_candump_line(const std::string &line, uint64_t &time_ns, std::string &iface, std::string &command)
+{
+    // (seconds.fraction)
+    size_t open = line.find('(');
+    size_t close = line.find(')', open);
+    size_t dot = line.find('.', open);
+    if (open == std::string::npos || close == std::string::npos || dot == std::string::npos || dot > close)
+    {
+        return false;
+    }
+
+    uint64_t sec = 0;
+    for (size_t i = open + 1; i < dot; i++)
+    {
+        if (!isdigit((unsigned char)line[i]))
+            return false;
+        sec = sec * 10 + (line[i] - '0');
+    }
+    uint64_t frac = 0;
+    size_t digits = 0;
+    for (size_t i = dot + 1; i < close; i++, digits++)
+    {
+        if (!isdigit((unsigned char)line[i]))
+            return false;
+        if (digits < 9)
+            frac = frac * 10 + (line[i] - '0');
+    }
+    for (; digits < 9; digits++)
+    {
+        frac *= 10;
+    }
+    time_ns = sec * 1000000000ull + frac;
+
+    // Skip the interface name, the frame is the third field
+    std::istringstream fields(line.substr(close + 1));
+    std::string frame;
+    if (!(fields >> iface >> frame))
+    {
+        return false;
+    }
+
+    size_t hash = frame.find('#');
+    if (hash != 3 && hash != 8)
+    {
+        return false;
+    }
+    std::string id = frame.substr(0, hash);
+    bool extended = (hash == 8);
+
+    // Error frames carry CAN_ERR_FLAG in the ID, nothing to send for them
+    if (extended && (hex_table.value[(uint8_t)id[0]] & 0x02))
+    {
+        return false;
+    }
+
+    std::string rest = frame.substr(hash + 1);
+    if (!rest.empty() && rest[0] == '#')
+    {
+        // CAN FD: ID##<flags nibble><data>, flag 0x01 = BRS
+        if (rest.length() < 2)
+            return false;
+        uint8_t fd_flags = hex_table.value[(uint8_t)rest[1]];
+        if (fd_flags & 0xF0)
+            return false;
+        char type = (fd_flags & 0x01) ? 'b' : 'd';
+        command = std::string(1, extended ? toupper(type) : type) + id + "#" + rest.substr(2);
+    }
+    else if (!rest.empty() && (rest[0] == 'R' || rest[0] == 'r'))
+    {
+        // Remote frame, optionally with its requested length
+        char dlc = (rest.length() > 1) ? rest[1] : '0';
+        if (dlc < '0' || dlc > '8')
+            return false;
+        command = std::string(1, extended ? 'R' : 'r') + id + dlc;
+    }
+    else
+    {
+        command = std::string(1, extended ? 'T' : 't') + id + "#" + rest;
+    }
+    return true;
+}
+
+int encode_cansend(const char *s, size_t len, char *out)
+{
+    const char *hash = static_cast<const char *>(memchr(s, '#', len));
+    if (!hash)
+    {
+        return 0;
+    }
+    const char *end = s + len;
+
+    char packet_type = s[0];
+    bool extended, fd;
+    switch (packet_type)
+    {
+    case 't':
+    case 'r':
+        extended = fd = false;
+        break;
+    case 'T':
+    case 'R':
+        extended = true;
+        fd = false;
+        break;
+    case 'd':
+    case 'b':
+        extended = false;
+        fd = true;
+        break;
+    case 'D':
+    case 'B':
+        extended = fd = true;
+        break;
+    default:
+        std::cerr << "Error: Invalid packet type '" << packet_type << "' (use t,T,r,R,d,D,b,B)" << std::endl;
+        return -1;
+    }
+
+    // ID, left padded with zeros to 3 or 8 digits
+    size_t id_len = hash - s - 1;
+    size_t id_digits = extended ? 8 : 3;
+    if (id_len > id_digits)
+    {
+        std::cerr << "Error: " << (extended ? "Extended CAN ID too long (max 8" : "Standard CAN ID too long (max 3")
+                  << " hex digits)" << std::endl;
+        return -1;
+    }
+    char *p = out;
+    *p++ = packet_type;
+    for (size_t i = id_len; i < id_digits; i++)
+    {
+        *p++ = '0';
+    }
+    uint8_t bad = 0;
+    for (const char *c = s + 1; c < hash; c++)
+    {
+        bad |= hex_table.value[(uint8_t)*c];
+        *p++ = *c;
+    }
+    if (bad & 0xF0)
+    {
+        std::cerr << "Error: Invalid CAN ID (must be hex): " << std::string(s + 1, hash) << std::endl;
+        return -1;
+    }
+
+    // Data, the DLC digit is filled in when the length is known
+    char *dlc_pos = p++;
+    char *data = p;
+    for (const char *c = hash + 1; c < end; c++)
+    {
+        if (*c == '.' || *c == ' ')
+        {
+            continue;
+        }
+        if (p - data == 2 * 64)
+        {
+            std::cerr << "Error: Data too long (max 64 bytes)" << std::endl;
+            return -1;
+        }
+        bad |= hex_table.value[(uint8_t)*c];
+        *p++ = *c;
+    }
+    if (bad & 0xF0)
+    {
+        std::cerr << "Error: Invalid hex data: " << std::string(hash + 1, end) << std::endl;
+        return -1;
+    }
+    if ((p - data) % 2 != 0)
+    {
+        std::cerr << "Error: Data must have even number of hex digits" << std::endl;
+        return -1;
+    }
+
+    size_t bytes = (p - data) / 2;
+    if (!fd && bytes > 8)
+    {
+        std::cerr << "Error: Classic CAN frames carry at most 8 bytes, use d or b for CAN FD" << std::endl;
+        return -1;
+    }
+    uint8_t dlc = len_to_dlc[bytes];
+    for (size_t i = bytes; i < dlc_to_len[dlc]; i++)
+    {
+        *p++ = '0';
+        *p++ = '0';
+    }
+    *dlc_pos = hex_upper[dlc];
+    *p++ = '\r';
+    return (int)(p - out);
+}
+
+std::string convert_cansend_format(const std::string &input)
+{
+    char out[SLCAN_MAX_COMMAND];
+    int n = encode_cansend(input.data(), input.size(), out);
+    return n > 0 ? std::string(out, n - 1) : input;
+}
+
+std::string get_feedback_description(const SlcanRecord &response)
+{
+    // Feedback codes start with #
+    if (response.len == 0 || response.data[0] != '#')
+    {
+        return "";
+    }
+
+    // A lone # (the \r has already been stripped by the framer) is success
+    if (response.len == 1)
+    {
+        return " (Success)";
+    }
+
+    switch (response.data[1])
+    {
+    case '1':
+        return " (Invalid command)";
+    case '2':
+        return " (Invalid parameter)";
+    case '3':
+        return " (Adapter must be open)";
+    case '4':
+        return " (Adapter must be closed)";
+    case '5':
+        return " (HAL error from ST Microelectronics)";
+    case '6':
+        return " (Feature not supported/implemented)";
+    case '7':
+        return " (CAN Tx buffer full - no ACK, 67 packets waiting)";
+    case '8':
+        return " (CAN bus off - severe error occurred)";
+    case '9':
+        return " (Sending not possible in silent mode)";
+    case ':':
+        return " (Baudrate not set)";
+    case ';':
+        return " (Flash Option Bytes programming failed)";
+    case '<':
+        return " (Hardware reset required - reconnect USB)";
+    default:
+        return "";
+    }
+}
+
+std::string get_error_description(const SlcanRecord &response)
+{
+    // Error format: Exxxxxxxx (9 characters total: E + 8 hex digits)
+    if (response.len < 9 || response.data[0] != 'E')
+    {
+        return "";
+    }
+
+    const char *error_code = response.data + 1;
+
+    // Validate it's all hex digits
+    uint8_t raw[4];
+    if (!decode_hex_bytes(error_code, raw, 4))
+    {
+        return "";
+    }
+
+    std::string desc = " (";
+
+    // Digit 1: Bus Status
+    char bus_status = error_code[0];
+    switch (bus_status)
+    {
+    case '0':
+        desc += "Bus Active";
+        break;
+    case '1':
+        desc += "Warning Level";
+        break;
+    case '2':
+        desc += "Bus Passive";
+        break;
+    case '3':
+        desc += "Bus Off";
+        break;
+    default:
+        desc += "Unknown Bus Status";
+    }
+
+    // Digit 2: Last Protocol Error
+    char protocol_error = error_code[1];
+    if (protocol_error != '0')
+    {
+        desc += ", ";
+        switch (protocol_error)
+        {
+        case '1':
+            desc += "Bit stuffing error";
+            break;
+        case '2':
+            desc += "Frame format error";
+            break;
+        case '3':
+            desc += "No ACK received";
+            break;
+        case '4':
+            desc += "Recessive bit error";
+            break;
+        case '5':
+            desc += "Dominant bit error";
+            break;
+        case '6':
+            desc += "CRC error";
+            break;
+        default:
+            desc += "Unknown protocol error";
+        }
+    }
+
+    // Digits 3+4: Firmware Error Flags (hex)
+    int flags = raw[1];
+
+    if (flags != 0)
+    {
+        desc += ", ";
+        bool first = true;
+        if (flags & 0x01)
+        {
+            desc += "Rx Failed";
+            first = false;
+        }
+        if (flags & 0x02)
+        {
+            if (!first)
+                desc += "+";
+            desc += "Tx Failed";
+            first = false;
+        }
+        if (flags & 0x04)
+        {
+            if (!first)
+                desc += "+";
+            desc += "CAN Tx buffer overflow";
+            first = false;
+        }
+        if (flags & 0x08)
+        {
+            if (!first)
+                desc += "+";
+            desc += "USB IN buffer overflow";
+            first = false;
+        }
+        if (flags & 0x10)
+        {
+            if (!first)
+                desc += "+";
+            desc += "Tx Timeout";
+            first = false;
+        }
+    }
+
+    // Digits 5+6: Tx Error Count
+    int tx_count = raw[2];
+
+    // Digits 7+8: Rx Error Count
+    int rx_count = raw[3];
+
+    desc += ", Tx Errors: " + std::to_string(tx_count);
+    desc += ", Rx Errors: " + std::to_string(rx_count);
+    desc += ")";
+
+    return desc;
+}
+
+int parse_bus_load(const SlcanRecord &msg)
+{
+    if (msg.len < 2 || msg.len > 4 || msg.data[0] != 'L')
+    {
+        return -1;
+    }
+    int load = 0;
+    for (size_t i = 1; i < msg.len; i++)
+    {
+        if (msg.data[i] < '0' || msg.data[i] > '9')
+        {
+            return -1;
+        }
+        load = load * 10 + (msg.data[i] - '0');
+    }
+    return load;
+}
+
+std::string get_record_description(const SlcanRecord &msg)
+{
+    switch (msg.data[0])
+    {
+    case '#':
+        return get_feedback_description(msg);
+    case 'E':
+        return get_error_description(msg);
+    case 'M':
+        return msg.len == 3 ? " (Tx echo)" : "";
+    case 'L':
+    {
+        int load = parse_bus_load(msg);
+        return load < 0 ? "" : " (Bus load " + std::to_string(load) + "%)";
+    }
+    default:
+        return "";
+    }
+}
+
+std::vector<std::string> parse_commands(const std::string &cmd_string)
+{
+    std::vector<std::string> commands;
+    std::string current_cmd;
+    bool in_quotes = false;
+
+    for (size_t i = 0; i < cmd_string.length(); i++)
+    {
+        char c = cmd_string[i];
+
+        if (c == '"')
+        {
+            // Toggle quote mode but don't add the quote character
+            in_quotes = !in_quotes;
+        }
+        else if (c == ',' && !in_quotes)
+        {
+            // Comma outside quotes - this is a separator
+            // Trim whitespace from current command
+            size_t start = current_cmd.find_first_not_of(" \t");
+            size_t end = current_cmd.find_last_not_of(" \t");
+            if (start != std::string::npos && end != std::string::npos)
+            {
+                commands.push_back(current_cmd.substr(start, end - start + 1));
+            }
+            current_cmd.clear();
+        }
+        else
+        {
+            // Regular character or comma inside quotes
+            current_cmd += c;
+        }
+    }
+
+    // Don't forget the last command
+    size_t start = current_cmd.find_first_not_of(" \t");
+    size_t end = current_cmd.find_last_not_of(" \t");
+    if (start != std::string::npos && end != std::string::npos)
+    {
+        commands.push_back(current_cmd.substr(start, end - start + 1));
+    }
+
+    return commands;
+}
@@ -0,0 +1,274 @@
+/* SPDX-License-Identifier: (GPL-2.0-only OR BSD-3-Clause) */
+/*
+ * slcan.h - SLCAN protocol library
+ *
+ * Splitting the serial byte stream into records, decoding received frames,
+ * converting cansend syntax into SLCAN commands, candump log lines and the
+ * descriptions of feedback codes and error reports. Shared by
+ * slcan_terminal, slcan_sim and slcan_bench.
+ */
+
+#ifndef SLCAN_H
+#define SLCAN_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+#include <time.h>
+
+// One complete SLCAN record (without the terminating \r), pointing into the
+// RX framer buffer. Valid until the next call to RxFramer::write_ptr().
+struct SlcanRecord
+{
+    const char *data;
+    size_t len;
+};
+
+// Persistent RX buffer that splits the serial byte stream into \r-terminated
+// records. Bytes are read directly into the buffer, a record that straddles
+// two read() calls is carried over to the next one and complete records are
+// handed out as views without copying.
+class RxFramer
+{
+private:
+    std::vector<char> buf;
+    size_t begin; // First byte of the oldest unconsumed record
+    size_t end;   // One past the last valid byte
+    size_t scan;  // Position where the search for \r continues
+    size_t overruns;
+
+public:
+    static const size_t CAPACITY = 64 * 1024;
+
+    RxFramer() : buf(CAPACITY), begin(0), end(0), scan(0), overruns(0) {}
+
+    // Returns the free space for the next read(). Compacts the buffer first,
+    // which invalidates all records returned so far.
+    char *write_ptr()
+    {
+        if (begin == end)
+        {
+            begin = end = scan = 0;
+        }
+        else if (begin > 0 && CAPACITY - end < CAPACITY / 2)
+        {
+            // Only the partial tail is left, so this moves at most one record
+            memmove(&buf[0], &buf[begin], end - begin);
+            end -= begin;
+            scan -= begin;
+            begin = 0;
+        }
+        else if (begin == 0 && end == CAPACITY)
+        {
+            // A full buffer without a single \r is garbage - drop it
+            overruns++;
+            end = scan = 0;
+        }
+        return &buf[end];
+    }
+
+    size_t write_space() const
+    {
+        return CAPACITY - end;
+    }
+
+    void commit(size_t n)
+    {
+        end += n;
+    }
+
+    // Fetches the next complete record, skipping empty lines and any stray
+    // \n characters around it. Returns false when only a partial record is left.
+    bool next(SlcanRecord &rec)
+    {
+        while (scan < end)
+        {
+            const char *cr = static_cast<const char *>(memchr(&buf[scan], '\r', end - scan));
+            if (!cr)
+            {
+                scan = end;
+                return false;
+            }
+
+            const char *first = &buf[begin];
+            const char *last = cr;
+            begin = scan = (cr - &buf[0]) + 1;
+
+            while (first < last && *first == '\n')
+                first++;
+            while (last > first && last[-1] == '\n')
+                last--;
+
+            if (first < last)
+            {
+                rec.data = first;
+                rec.len = last - first;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Drops everything buffered, e.g. a partial record of a device that has
+    // gone away
+    void reset()
+    {
+        begin = end = scan = 0;
+    }
+
+    size_t overrun_count() const
+    {
+        return overruns;
+    }
+};
+
+// CAN frame flags, named after the frame bits in the SLCAN manual
+enum CanFrameFlags
+{
+    CAN_FLAG_EXT = 0x01, // 29 bit ID (IDE)
+    CAN_FLAG_RTR = 0x02, // Remote Transmission Request
+    CAN_FLAG_FDF = 0x04, // CAN FD frame
+    CAN_FLAG_BRS = 0x08, // CAN FD baudrate switch
+    CAN_FLAG_ESI = 0x10, // CAN FD sender is error passive (trailing 'S')
+};
+
+// Decoded CAN / CAN FD frame
+struct CanFrame
+{
+    uint64_t timestamp_ns; // Host CLOCK_MONOTONIC time of reception
+    uint32_t id;
+    uint8_t channel; // Adapter it was received on
+    uint8_t flags;   // CanFrameFlags
+    uint8_t dlc;   // DLC code 0..15
+    uint8_t len;   // Payload length in bytes
+    uint8_t data[64];
+};
+
+static inline uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// The lookup tables below are constant expressions, so every translation
+// unit sees their contents and nothing has to run before main()
+
+constexpr uint8_t hex_nibble(int c)
+{
+    return (c >= '0' && c <= '9') ? c - '0'
+           : (c >= 'A' && c <= 'F') ? c - 'A' + 10
+           : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+                                    : 0xFF;
+}
+
+#define SLCAN_HEX_ROW(r)                                                                                             \
+    hex_nibble(r + 0), hex_nibble(r + 1), hex_nibble(r + 2), hex_nibble(r + 3), hex_nibble(r + 4),                  \
+        hex_nibble(r + 5), hex_nibble(r + 6), hex_nibble(r + 7), hex_nibble(r + 8), hex_nibble(r + 9),              \
+        hex_nibble(r + 10), hex_nibble(r + 11), hex_nibble(r + 12), hex_nibble(r + 13), hex_nibble(r + 14),         \
+        hex_nibble(r + 15)
+
+// Hex digit -> nibble lookup, 0xFF for anything that is not a hex digit
+struct HexTable
+{
+    uint8_t value[256];
+};
+
+constexpr HexTable hex_table = {{
+    SLCAN_HEX_ROW(0x00), SLCAN_HEX_ROW(0x10), SLCAN_HEX_ROW(0x20), SLCAN_HEX_ROW(0x30),
+    SLCAN_HEX_ROW(0x40), SLCAN_HEX_ROW(0x50), SLCAN_HEX_ROW(0x60), SLCAN_HEX_ROW(0x70),
+    SLCAN_HEX_ROW(0x80), SLCAN_HEX_ROW(0x90), SLCAN_HEX_ROW(0xA0), SLCAN_HEX_ROW(0xB0),
+    SLCAN_HEX_ROW(0xC0), SLCAN_HEX_ROW(0xD0), SLCAN_HEX_ROW(0xE0), SLCAN_HEX_ROW(0xF0),
+}};
+
+#undef SLCAN_HEX_ROW
+
+// Nibble -> hex digit
+constexpr char hex_upper[17] = "0123456789ABCDEF";
+
+// Payload length of an SLCAN DLC digit ('0'..'9', 'A'..'F')
+constexpr uint8_t dlc_to_len[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
+
+// Smallest DLC whose payload holds n bytes, n = 0..64. CAN FD pads the
+// data up to dlc_to_len[len_to_dlc[n]] bytes.
+constexpr uint8_t len_to_dlc[65] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8,                                      // Classic CAN
+    9, 9, 9, 9, 10, 10, 10, 10, 11, 11, 11, 11, 12, 12, 12, 12,     // 9..24
+    13, 13, 13, 13, 13, 13, 13, 13,                                 // 25..32
+    14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, // 33..48
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, // 49..64
+};
+
+// Longest SLCAN frame command: 'D', 8 ID digits, DLC, 64 data bytes and \r
+static const size_t SLCAN_MAX_COMMAND = 1 + 8 + 1 + 2 * 64 + 1;
+
+// Decodes n bytes from 2*n hex digits. Invalid digits are collected in one
+// accumulator and checked once at the end instead of branching per digit.
+static inline bool decode_hex_bytes(const char *in, uint8_t *out, size_t n)
+{
+    uint8_t bad = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        uint8_t hi = hex_table.value[(uint8_t)in[2 * i]];
+        uint8_t lo = hex_table.value[(uint8_t)in[2 * i + 1]];
+        bad |= hi | lo;
+        out[i] = (uint8_t)((hi << 4) | (lo & 0x0F));
+    }
+    return (bad & 0xF0) == 0;
+}
+
+// Decodes an RX packet (t/T/r/R/d/D/b/B) into a CanFrame, see info/send_packet.md:
+// <type><3 or 8 digit ID><DLC><data>['S']. Returns false if the record is
+// not a well formed packet. The timestamp and channel are left to the caller.
+bool decode_slcan_frame(const char *s, size_t len, CanFrame &frame);
+
+// Length of a transmit frame command (without \r) that can carry a Tx echo
+// marker, i.e. t/T/d/D/b/B with an ID, DLC and exactly DLC data bytes.
+// Returns 0 for everything else.
+size_t slcan_tx_frame_len(const char *s, size_t len);
+
+// SLCAN DLC digit for a payload of byte_count bytes, more than 64 give 'F'
+constexpr char encode_dlc(int byte_count)
+{
+    return hex_upper[len_to_dlc[byte_count < 0 ? 0 : byte_count > 64 ? 64 : byte_count]];
+}
+
+// Encodes cansend syntax "<type><id>#<data>" of len bytes into an SLCAN
+// command with its \r in out, which needs SLCAN_MAX_COMMAND bytes. Dots and
+// spaces between the data bytes are skipped, CAN FD data is padded with
+// zeros to the next valid length. Returns the length of the command, 0 if
+// the input has no '#' (it is not cansend syntax), or -1 for invalid input,
+// which is reported on stderr. Allocates nothing.
+int encode_cansend(const char *s, size_t len, char *out);
+
+// String version of encode_cansend() without the \r. Anything without '#'
+// and invalid input are returned unchanged.
+std::string convert_cansend_format(const std::string &input);
+
+// " (description)" of a feedback code (#, #1..#<), error report (E...),
+// Tx echo or bus load report, or "" for everything else
+std::string get_feedback_description(const SlcanRecord &response);
+std::string get_error_description(const SlcanRecord &response);
+std::string get_record_description(const SlcanRecord &msg);
+
+// L<nn> bus load report in percent or -1
+int parse_bus_load(const SlcanRecord &msg);
+
+// Formats a frame as one candump log line "(sec.usec) iface ID#DATA\n".
+// wall_offset_ns converts the CLOCK_MONOTONIC timestamp to wall clock time.
+// out needs room for 32 + strlen(iface) + 160 characters.
+size_t format_candump_line(const CanFrame &frame, int64_t wall_offset_ns, const char *iface, char *out);
+
+// Parses one candump log line "(1436509052.249713) can0 123#DEADBEEF" into its
+// timestamp, interface and the equivalent <type><id>#<data> command. RTR
+// frames with a length ("123#R4") are returned as raw SLCAN since cansend
+// syntax cannot express their DLC. Returns false for lines that are not CAN
+// frames.
+bool parse_candump_line(const std::string &line, uint64_t &time_ns, std::string &iface, std::string &command);
+
+// Splits a comma separated command list, commas inside double quotes do
+// not separate and the quotes are removed
+std::vector<std::string> parse_commands(const std::string &cmd_string);
+
+#endif // SLCAN_H
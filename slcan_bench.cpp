@@ -0,0 +1,379 @@
+/* SPDX-License-Identifier: (GPL-2.0-only OR BSD-3-Clause) */
+/*
+ * slcan_bench.cpp - Microbenchmarks of the SLCAN protocol library
+ *
+ * Measures the hot paths of slcan_terminal on synthetic but realistic
+ * traffic: splitting the serial stream into records, decoding frames,
+ * converting cansend syntax, describing feedback and error reports and
+ * formatting candump lines. Each benchmark repeats a fixed workload for a
+ * given time and reports the fastest and the mean time per operation.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <time.h>
+
+#include "slcan.h"
+
+static volatile uint64_t sink; // Keeps the compiler from dropping results
+
+// Deterministic traffic, the same on every run
+class Random
+{
+private:
+    uint64_t state;
+
+public:
+    explicit Random(uint64_t seed) : state(seed) {}
+
+    uint32_t next()
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return (uint32_t)(state >> 16);
+    }
+
+    // True with a probability of percent / 100
+    bool chance(unsigned percent)
+    {
+        return next() % 100 < percent;
+    }
+};
+
+static void append_hex(std::string &out, uint32_t value, int digits)
+{
+    for (int i = digits - 1; i >= 0; i--)
+    {
+        out += hex_upper[(value >> (4 * i)) & 0x0F];
+    }
+}
+
+// A received CAN packet as the adapter sends it, without \r
+static std::string random_frame(Random &rnd)
+{
+    static const char types[] = "tTdDbBrR";
+    unsigned pick = rnd.next() % 100;
+    // 55% classic 11 bit, 20% classic 29 bit, 20% CAN FD, 5% RTR
+    char type = types[pick < 55 ? 0 : pick < 75 ? 1 : pick < 95 ? 2 + rnd.next() % 4 : 6 + rnd.next() % 2];
+    bool extended = type >= 'A' && type <= 'Z';
+    bool fd = type == 'd' || type == 'D' || type == 'b' || type == 'B';
+
+    std::string text(1, type);
+    append_hex(text, extended ? rnd.next() & 0x1FFFFFFF : rnd.next() & 0x7FF, extended ? 8 : 3);
+    unsigned dlc = fd ? rnd.next() % 16 : (rnd.chance(80) ? 8 : rnd.next() % 9);
+    text += hex_upper[dlc];
+    if (type != 'r' && type != 'R')
+    {
+        for (unsigned i = 0; i < dlc_to_len[dlc]; i++)
+        {
+            append_hex(text, rnd.next() & 0xFF, 2);
+        }
+    }
+    return text;
+}
+
+static std::string random_error_report(Random &rnd)
+{
+    std::string text = "E";
+    append_hex(text, rnd.next() % 4, 1);
+    append_hex(text, rnd.chance(70) ? 0 : rnd.next() % 7, 1);
+    append_hex(text, rnd.chance(70) ? 0 : rnd.next() & 0x1F, 2);
+    append_hex(text, rnd.next() & 0xFF, 2);
+    append_hex(text, rnd.next() & 0xFF, 2);
+    return text;
+}
+
+// Everything the RX thread sees with feedback and echo markers enabled:
+// mostly frames, then feedback codes, Tx echoes, bus load and error reports
+static std::vector<std::string> rx_mix(size_t count)
+{
+    static const char *feedback[] = {"#", "#", "#", "#", "#7", "#3", "#1", "#2"};
+    Random rnd(1);
+    std::vector<std::string> records;
+    for (size_t i = 0; i < count; i++)
+    {
+        unsigned pick = rnd.next() % 100;
+        if (pick < 80)
+        {
+            records.push_back(random_frame(rnd));
+        }
+        else if (pick < 90)
+        {
+            records.push_back(feedback[rnd.next() % 8]);
+        }
+        else if (pick < 97)
+        {
+            std::string echo = "M";
+            append_hex(echo, rnd.next() & 0xFF, 2);
+            records.push_back(echo);
+        }
+        else if (pick < 99)
+        {
+            records.push_back("L" + std::to_string(rnd.next() % 101));
+        }
+        else
+        {
+            records.push_back(random_error_report(rnd));
+        }
+    }
+    return records;
+}
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+struct BenchOptions
+{
+    double seconds;
+    std::vector<std::string> only;
+};
+
+// Runs body (which performs ops operations) repeatedly for the configured
+// time and prints the best and mean time per operation
+template <typename Body>
+static void run(const BenchOptions &opt, const char *name, size_t ops, size_t bytes, Body body)
+{
+    if (!opt.only.empty())
+    {
+        bool selected = false;
+        for (size_t i = 0; i < opt.only.size(); i++)
+        {
+            selected = selected || strstr(name, opt.only[i].c_str()) != nullptr;
+        }
+        if (!selected)
+            return;
+    }
+
+    body(); // Warm up caches and branch predictors
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t)(opt.seconds * 1e9);
+    uint64_t best = UINT64_MAX;
+    uint64_t rounds = 0;
+    uint64_t now = start;
+    do
+    {
+        uint64_t t0 = now;
+        body();
+        now = now_ns();
+        if (now - t0 < best)
+            best = now - t0;
+        rounds++;
+    } while (now < end);
+
+    double best_ns = (double)best / ops;
+    double mean_ns = (double)(now - start) / rounds / ops;
+    printf("%-18s %10.1f %10.1f %10.2f", name, best_ns, mean_ns, 1e3 / best_ns);
+    if (bytes)
+    {
+        printf(" %10.1f", bytes * 1e3 / best);
+    }
+    printf("\n");
+}
+
+static void print_usage(const char *prg)
+{
+    std::cerr << prg << " - Microbenchmarks of the SLCAN protocol library\n"
+              << std::endl;
+    std::cerr << "Usage: " << prg << " [options] [benchmark...]\n"
+              << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  -h, --help            Show this help message" << std::endl;
+    std::cerr << "  -t, --time <s>        Time per benchmark in seconds (default 1)" << std::endl;
+    std::cerr << "\nBenchmarks are selected by a part of their name, default all:" << std::endl;
+    std::cerr << "  rx_split, decode_frame, rx_path, cansend, error_report, feedback, candump_format" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions opt;
+    opt.seconds = 1.0;
+
+    static struct option long_options[] = {
+        {"help", no_argument, 0, 'h'},
+        {"time", required_argument, 0, 't'},
+        {0, 0, 0, 0}};
+
+    int c;
+    while ((c = getopt_long(argc, argv, "ht:", long_options, nullptr)) != -1)
+    {
+        switch (c)
+        {
+        case 't':
+            opt.seconds = atof(optarg);
+            if (opt.seconds <= 0)
+            {
+                std::cerr << "Error: Invalid time: " << optarg << std::endl;
+                return 1;
+            }
+            break;
+        case 'h':
+        default:
+            print_usage(argv[0]);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    for (int i = optind; i < argc; i++)
+    {
+        opt.only.push_back(argv[i]);
+    }
+
+    // Workloads, built once
+    static const size_t RECORDS = 16384;
+    std::vector<std::string> mix = rx_mix(RECORDS);
+    std::string stream;
+    for (size_t i = 0; i < mix.size(); i++)
+    {
+        stream += mix[i];
+        stream += '\r';
+    }
+
+    Random rnd(2);
+    std::vector<std::string> frames;
+    for (size_t i = 0; i < RECORDS; i++)
+    {
+        frames.push_back(random_frame(rnd));
+    }
+    size_t frame_bytes = 0;
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        frame_bytes += frames[i].size() + 1;
+    }
+
+    std::vector<CanFrame> decoded(frames.size());
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        decode_slcan_frame(frames[i].data(), frames[i].size(), decoded[i]);
+        decoded[i].timestamp_ns = 1000000000ull * 1700000000 + i * 100000;
+    }
+
+    // What people type: short classic frames, dotted bytes, 29 bit IDs, CAN FD
+    std::vector<std::string> cansend;
+    for (size_t i = 0; i < 1024; i++)
+    {
+        const CanFrame &f = decoded[i];
+        std::string text(1, (f.flags & CAN_FLAG_FDF) ? ((f.flags & CAN_FLAG_EXT) ? 'B' : 'b')
+                                                       : ((f.flags & CAN_FLAG_EXT) ? 'T' : 't'));
+        append_hex(text, f.id, (f.flags & CAN_FLAG_EXT) ? 8 : 3);
+        text += '#';
+        for (unsigned b = 0; b < f.len && !(f.flags & CAN_FLAG_RTR); b++)
+        {
+            if (b > 0 && i % 4 == 0)
+                text += '.';
+            append_hex(text, f.data[b], 2);
+        }
+        cansend.push_back(text);
+    }
+
+    std::vector<std::string> errors;
+    for (size_t i = 0; i < 1024; i++)
+    {
+        errors.push_back(random_error_report(rnd));
+    }
+    std::vector<std::string> feedback;
+    for (size_t i = 0; i < mix.size(); i++)
+    {
+        if (mix[i][0] != 't' && mix[i][0] != 'T' && mix[i][0] != 'd' && mix[i][0] != 'D' && mix[i][0] != 'b' &&
+            mix[i][0] != 'B' && mix[i][0] != 'r' && mix[i][0] != 'R')
+            feedback.push_back(mix[i]);
+    }
+
+    printf("%-18s %10s %10s %10s %10s\n", "benchmark", "best ns/op", "mean ns/op", "Mops/s", "MB/s");
+
+    // Serial stream into records, in chunks like USB reads return them
+    RxFramer framer;
+    run(opt, "rx_split", mix.size(), stream.size(), [&]() {
+        static const size_t CHUNK = 512;
+        uint64_t n = 0;
+        for (size_t pos = 0; pos < stream.size(); pos += CHUNK)
+        {
+            size_t len = stream.size() - pos < CHUNK ? stream.size() - pos : CHUNK;
+            memcpy(framer.write_ptr(), stream.data() + pos, len);
+            framer.commit(len);
+            SlcanRecord rec;
+            while (framer.next(rec))
+                n += rec.len;
+        }
+        sink = n;
+    });
+
+    run(opt, "decode_frame", frames.size(), frame_bytes, [&]() {
+        uint64_t n = 0;
+        CanFrame frame;
+        for (size_t i = 0; i < frames.size(); i++)
+        {
+            if (decode_slcan_frame(frames[i].data(), frames[i].size(), frame))
+                n += frame.id;
+        }
+        sink = n;
+    });
+
+    // What the RX thread does per read: split, then decode or classify
+    run(opt, "rx_path", mix.size(), stream.size(), [&]() {
+        static const size_t CHUNK = 512;
+        uint64_t n = 0;
+        CanFrame frame;
+        for (size_t pos = 0; pos < stream.size(); pos += CHUNK)
+        {
+            size_t len = stream.size() - pos < CHUNK ? stream.size() - pos : CHUNK;
+            memcpy(framer.write_ptr(), stream.data() + pos, len);
+            framer.commit(len);
+            SlcanRecord rec;
+            while (framer.next(rec))
+            {
+                if (decode_slcan_frame(rec.data, rec.len, frame))
+                    n += frame.len;
+                else
+                    n += parse_bus_load(rec) + rec.data[0];
+            }
+        }
+        sink = n;
+    });
+
+    run(opt, "cansend", cansend.size(), 0, [&]() {
+        char out[SLCAN_MAX_COMMAND];
+        uint64_t n = 0;
+        for (size_t i = 0; i < cansend.size(); i++)
+            n += encode_cansend(cansend[i].data(), cansend[i].size(), out);
+        sink = n;
+    });
+
+    run(opt, "error_report", errors.size(), 0, [&]() {
+        uint64_t n = 0;
+        for (size_t i = 0; i < errors.size(); i++)
+        {
+            SlcanRecord rec = {errors[i].data(), errors[i].size()};
+            n += get_error_description(rec).size();
+        }
+        sink = n;
+    });
+
+    run(opt, "feedback", feedback.size(), 0, [&]() {
+        uint64_t n = 0;
+        for (size_t i = 0; i < feedback.size(); i++)
+        {
+            SlcanRecord rec = {feedback[i].data(), feedback[i].size()};
+            n += get_record_description(rec).size();
+        }
+        sink = n;
+    });
+
+    run(opt, "candump_format", decoded.size(), 0, [&]() {
+        char line[256];
+        uint64_t n = 0;
+        for (size_t i = 0; i < decoded.size(); i++)
+            n += format_candump_line(decoded[i], 0, "ttyACM0", line);
+        sink = n;
+    });
+
+    return 0;
+}
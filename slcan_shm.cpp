@@ -0,0 +1,215 @@
+/* SPDX-License-Identifier: (GPL-2.0-only OR BSD-3-Clause) */
+/*
+ * slcan_shm.cpp - Shared memory ring of received CAN frames
+ */
+
+#include "slcan_shm.h"
+
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static std::string shm_path(const std::string &name)
+{
+    return (!name.empty() && name[0] == '/') ? name : "/" + name;
+}
+
+SlcanShmWriter::SlcanShmWriter()
+    : map(nullptr), map_size(0), header(nullptr), slots(nullptr), next_seq(1), current(nullptr)
+{
+}
+
+SlcanShmWriter::~SlcanShmWriter()
+{
+    close();
+}
+
+bool SlcanShmWriter::open(const std::string &shm_name, const std::vector<std::string> &ifaces, size_t slot_count)
+{
+    if (slot_count == 0 || (slot_count & (slot_count - 1)) != 0)
+    {
+        std::cerr << "Error: Shared memory ring size must be a power of two" << std::endl;
+        return false;
+    }
+    if (ifaces.size() > SlcanShmHeader::MAX_CHANNELS)
+    {
+        std::cerr << "Error: At most " << (size_t)SlcanShmHeader::MAX_CHANNELS << " channels in a shared memory ring"
+                  << std::endl;
+        return false;
+    }
+
+    // A new object instead of truncating the old one, readers still
+    // attached to the old one keep a valid mapping
+    name = shm_path(shm_name);
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        perror("shm_open");
+        return false;
+    }
+
+    size_t header_size = (sizeof(SlcanShmHeader) + 127) & ~(size_t)127;
+    map_size = header_size + slot_count * sizeof(SlcanShmSlot);
+    if (ftruncate(fd, map_size) < 0)
+    {
+        perror("ftruncate");
+        ::close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+    map = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror("mmap");
+        map = nullptr;
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    // The object is zero filled: every slot has sequence number 0
+    header = static_cast<SlcanShmHeader *>(map);
+    slots = reinterpret_cast<SlcanShmSlot *>(static_cast<char *>(map) + header_size);
+    header->version = SlcanShmHeader::VERSION;
+    header->slot_count = (uint32_t)slot_count;
+    header->slot_size = sizeof(SlcanShmSlot);
+    header->channel_count = (uint32_t)ifaces.size();
+    for (size_t c = 0; c < ifaces.size(); c++)
+    {
+        strncpy(header->ifaces[c], ifaces[c].c_str(), SlcanShmHeader::IFACE_LEN - 1);
+    }
+    next_seq = 1;
+    header->next_seq.store(next_seq, std::memory_order_relaxed);
+    header->writer_open.store(1, std::memory_order_relaxed);
+
+    // Readers check the magic last
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = SlcanShmHeader::MAGIC;
+    return true;
+}
+
+void SlcanShmWriter::close()
+{
+    if (!map)
+    {
+        return;
+    }
+    header->writer_open.store(0, std::memory_order_release);
+    munmap(map, map_size);
+    shm_unlink(name.c_str());
+    map = nullptr;
+    header = nullptr;
+    slots = nullptr;
+}
+
+SlcanShmReader::SlcanShmReader()
+    : map(nullptr), map_size(0), header(nullptr), slots(nullptr), next_seq(0), lost_frames(0)
+{
+}
+
+SlcanShmReader::~SlcanShmReader()
+{
+    close();
+}
+
+bool SlcanShmReader::open(const std::string &shm_name)
+{
+    std::string name = shm_path(shm_name);
+    int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        perror(("shm_open " + name).c_str());
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SlcanShmHeader))
+    {
+        std::cerr << "Error: " << name << " is not a SLCAN frame ring" << std::endl;
+        ::close(fd);
+        return false;
+    }
+    map_size = st.st_size;
+    map = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror("mmap");
+        map = nullptr;
+        return false;
+    }
+
+    header = static_cast<const SlcanShmHeader *>(map);
+    size_t header_size = (sizeof(SlcanShmHeader) + 127) & ~(size_t)127;
+    if (header->magic != SlcanShmHeader::MAGIC || header->version != SlcanShmHeader::VERSION ||
+        header->slot_size != sizeof(SlcanShmSlot) ||
+        header_size + (size_t)header->slot_count * sizeof(SlcanShmSlot) > map_size)
+    {
+        std::cerr << "Error: " << name << " is not a SLCAN frame ring (version " << SlcanShmHeader::VERSION << ")"
+                  << std::endl;
+        close();
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    slots = reinterpret_cast<const SlcanShmSlot *>(static_cast<const char *>(map) + header_size);
+
+    // Start with the next frame, not with the history in the ring
+    next_seq = header->next_seq.load(std::memory_order_acquire);
+    lost_frames = 0;
+    return true;
+}
+
+void SlcanShmReader::close()
+{
+    if (map)
+    {
+        munmap(map, map_size);
+        map = nullptr;
+        header = nullptr;
+        slots = nullptr;
+    }
+}
+
+bool SlcanShmReader::read(SlcanShmFrame &frame)
+{
+    uint32_t mask = header->slot_count - 1;
+    for (;;)
+    {
+        const SlcanShmSlot &slot = slots[next_seq & mask];
+        uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq == next_seq)
+        {
+            memcpy(&frame, &slot.frame, sizeof(frame));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) == next_seq)
+            {
+                next_seq++;
+                return true;
+            }
+        }
+        else if (seq < next_seq && next_seq >= header->next_seq.load(std::memory_order_acquire))
+        {
+            return false; // Nothing new
+        }
+        else if (seq < next_seq)
+        {
+            continue; // Published just now, or being written
+        }
+
+        // Overwritten: continue with the oldest frame that is surely still there
+        uint64_t newest = header->next_seq.load(std::memory_order_acquire);
+        uint64_t resume = newest - (mask + 1) / 2;
+        lost_frames += resume - next_seq;
+        next_seq = resume;
+    }
+}
+
+const char *SlcanShmReader::iface(unsigned channel) const
+{
+    return channel < header->channel_count ? header->ifaces[channel] : "can";
+}
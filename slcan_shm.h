@@ -0,0 +1,159 @@
+/* SPDX-License-Identifier: (GPL-2.0-only OR BSD-3-Clause) */
+/*
+ * slcan_shm.h - Shared memory ring of received CAN frames
+ *
+ * slcan_terminal --shm <name> publishes every received frame into a POSIX
+ * shared memory object. Any number of local processes can follow the ring
+ * with SlcanShmReader without locks and without slowing down the terminal:
+ * the writer never waits for readers, a reader that falls more than one
+ * ring behind loses the oldest frames and is told how many.
+ *
+ * Every slot carries the sequence number of the frame in it. The writer
+ * sets it to 0 before and to the frame's number after filling the slot.
+ * A reader copies the slot and checks the number again, so it never
+ * returns a frame that was overwritten while it was copied.
+ */
+
+#ifndef SLCAN_SHM_H
+#define SLCAN_SHM_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Frame flags, the same bits slcan_terminal uses internally
+enum SlcanShmFlags
+{
+    SLCAN_SHM_EXT = 0x01, // 29 bit ID
+    SLCAN_SHM_RTR = 0x02, // Remote Transmission Request
+    SLCAN_SHM_FDF = 0x04, // CAN FD frame
+    SLCAN_SHM_BRS = 0x08, // CAN FD baudrate switch
+    SLCAN_SHM_ESI = 0x10, // CAN FD sender is error passive
+};
+
+struct SlcanShmFrame
+{
+    uint64_t timestamp_ns; // CLOCK_MONOTONIC when the serial read returned
+    uint32_t id;
+    uint8_t flags;   // SlcanShmFlags
+    uint8_t dlc;
+    uint8_t len;     // Data bytes
+    uint8_t channel; // Adapter index, see SlcanShmReader::iface()
+    uint8_t data[64];
+};
+
+// Layout of the shared memory object: header, then slot_count slots
+struct SlcanShmHeader
+{
+    static const uint32_t MAGIC = 0x48534C53; // "SLSH"
+    static const uint32_t VERSION = 1;
+    static const size_t MAX_CHANNELS = 16;
+    static const size_t IFACE_LEN = 32;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count; // Power of two
+    uint32_t slot_size;
+    uint32_t channel_count;
+    std::atomic<uint32_t> writer_open; // 0 after the writer closed the ring
+    char ifaces[MAX_CHANNELS][IFACE_LEN];
+    alignas(64) std::atomic<uint64_t> next_seq; // Number of the next frame, the first is 1
+};
+
+struct SlcanShmSlot
+{
+    std::atomic<uint64_t> seq; // 0 while being written
+    SlcanShmFrame frame;
+    uint8_t padding[128 - sizeof(uint64_t) - sizeof(SlcanShmFrame)];
+};
+
+// Creates the ring and fills it. Used by one thread of one process.
+class SlcanShmWriter
+{
+private:
+    std::string name;
+    void *map;
+    size_t map_size;
+    SlcanShmHeader *header;
+    SlcanShmSlot *slots;
+    uint64_t next_seq;
+    SlcanShmSlot *current;
+
+public:
+    static const size_t DEFAULT_SLOTS = 65536;
+
+    SlcanShmWriter();
+    ~SlcanShmWriter();
+
+    // name as for shm_open(), a leading '/' is added if missing. ifaces are
+    // the names of the channels. An existing ring of the same name is
+    // replaced, readers attached to it see it closed.
+    bool open(const std::string &name, const std::vector<std::string> &ifaces, size_t slots = DEFAULT_SLOTS);
+    void close();
+
+    bool is_open() const
+    {
+        return map != nullptr;
+    }
+
+    // Returns the frame of the next slot to fill in, publish() makes it
+    // visible to readers. No other call in between.
+    SlcanShmFrame &begin()
+    {
+        current = &slots[next_seq & (header->slot_count - 1)];
+        current->seq.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        return current->frame;
+    }
+
+    void publish()
+    {
+        current->seq.store(next_seq, std::memory_order_release);
+        header->next_seq.store(++next_seq, std::memory_order_release);
+    }
+};
+
+// Follows a ring from its newest frame on. One reader per thread.
+class SlcanShmReader
+{
+private:
+    void *map;
+    size_t map_size;
+    const SlcanShmHeader *header;
+    const SlcanShmSlot *slots;
+    uint64_t next_seq;
+    uint64_t lost_frames;
+
+public:
+    SlcanShmReader();
+    ~SlcanShmReader();
+
+    bool open(const std::string &name);
+    void close();
+
+    // Copies the next frame and returns true, or returns false if there is
+    // no new frame yet. Never blocks.
+    bool read(SlcanShmFrame &frame);
+
+    // Frames overwritten before this reader got to them
+    uint64_t lost() const
+    {
+        return lost_frames;
+    }
+
+    bool writer_open() const
+    {
+        return header->writer_open.load(std::memory_order_acquire) != 0;
+    }
+
+    unsigned channel_count() const
+    {
+        return header->channel_count;
+    }
+
+    // Interface name of a channel, e.g. ttyACM0
+    const char *iface(unsigned channel) const;
+};
+
+#endif // SLCAN_SHM_H
@@ -0,0 +1,167 @@
+/* SPDX-License-Identifier: (GPL-2.0-only OR BSD-3-Clause) */
+/*
+ * slcan_shm_reader.cpp - Follows the frame ring of slcan_terminal --shm
+ *
+ * Prints every frame in candump log format, like candump -L, and how many
+ * frames it could not keep up with. Any number can run at the same time.
+ */
+
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "slcan_shm.h"
+
+static volatile sig_atomic_t quit_requested = 0;
+
+static void signal_handler(int)
+{
+    quit_requested = 1;
+}
+
+static void print_usage(const char *prg)
+{
+    std::cerr << prg << " - Print the frames of a slcan_terminal shared memory ring\n"
+              << std::endl;
+    std::cerr << "Usage: " << prg << " [options] <name>\n"
+              << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  -h, --help            Show this help message" << std::endl;
+    std::cerr << "  -c, --count           Only count the frames, print a summary every second" << std::endl;
+    std::cerr << "  -p, --poll <us>       Sleep between polls of an empty ring (default 500)" << std::endl;
+    std::cerr << "\nExample:" << std::endl;
+    std::cerr << "  slcan_terminal --shm slcan0 -i C,S6,ON /dev/ttyACM0" << std::endl;
+    std::cerr << "  " << prg << " slcan0 > capture.log" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    bool count_only = false;
+    long poll_us = 500;
+
+    static struct option long_options[] = {
+        {"help", no_argument, 0, 'h'},
+        {"count", no_argument, 0, 'c'},
+        {"poll", required_argument, 0, 'p'},
+        {0, 0, 0, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "hcp:", long_options, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            count_only = true;
+            break;
+        case 'p':
+            poll_us = strtol(optarg, nullptr, 10);
+            if (poll_us < 0)
+            {
+                std::cerr << "Error: Invalid poll interval: " << optarg << std::endl;
+                return 1;
+            }
+            break;
+        case 'h':
+        default:
+            print_usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind + 1 != argc)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    SlcanShmReader reader;
+    if (!reader.open(argv[optind]))
+    {
+        return 1;
+    }
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    // Receive times are CLOCK_MONOTONIC, candump logs show wall clock time
+    struct timespec mono, real;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+    int64_t wall_offset_ns = ((int64_t)real.tv_sec - mono.tv_sec) * 1000000000ll + (real.tv_nsec - mono.tv_nsec);
+
+    static const char hex[] = "0123456789ABCDEF";
+    SlcanShmFrame frame;
+    uint64_t frames = 0, shown = 0;
+    struct timespec last_report;
+    clock_gettime(CLOCK_MONOTONIC, &last_report);
+    char line[256];
+
+    while (!quit_requested)
+    {
+        if (!reader.read(frame))
+        {
+            if (!reader.writer_open())
+            {
+                break;
+            }
+            if (count_only)
+            {
+                struct timespec now;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                if (now.tv_sec > last_report.tv_sec)
+                {
+                    std::cerr << frames << " frames (" << frames - shown << "/s), " << reader.lost() << " lost"
+                              << std::endl;
+                    shown = frames;
+                    last_report = now;
+                }
+            }
+            else
+            {
+                fflush(stdout);
+            }
+            usleep(poll_us);
+            continue;
+        }
+
+        frames++;
+        if (count_only)
+        {
+            continue;
+        }
+
+        uint64_t t = frame.timestamp_ns + wall_offset_ns;
+        char *p = line;
+        p += sprintf(p, "(%llu.%06llu) %s ", (unsigned long long)(t / 1000000000ull),
+                     (unsigned long long)(t % 1000000000ull / 1000), reader.iface(frame.channel));
+        p += sprintf(p, (frame.flags & SLCAN_SHM_EXT) ? "%08X" : "%03X", frame.id);
+        *p++ = '#';
+        if (frame.flags & SLCAN_SHM_FDF)
+        {
+            *p++ = '#';
+            *p++ = hex[((frame.flags & SLCAN_SHM_BRS) ? 1 : 0) | ((frame.flags & SLCAN_SHM_ESI) ? 2 : 0)];
+        }
+        if (frame.flags & SLCAN_SHM_RTR)
+        {
+            *p++ = 'R';
+        }
+        else
+        {
+            for (unsigned i = 0; i < frame.len; i++)
+            {
+                *p++ = hex[frame.data[i] >> 4];
+                *p++ = hex[frame.data[i] & 0x0F];
+            }
+        }
+        *p++ = '\n';
+        fwrite(line, 1, p - line, stdout);
+    }
+
+    fflush(stdout);
+    std::cerr << frames << " frames read, " << reader.lost() << " lost" << std::endl;
+    return 0;
+}
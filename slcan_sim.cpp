@@ -0,0 +1,1052 @@
+/* SPDX-License-Identifier: (GPL-2.0-only OR BSD-3-Clause) */
+/*
+ * slcan_sim.cpp - Simulated SLCAN adapter on a pseudo terminal
+ *
+ * Emulates the CANable 2.5 Slcan protocol (info/slcan25.md) so that
+ * slcan_terminal can be tested and benchmarked without an adapter.
+ */
+
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "slcan.h"
+
+// Bitrates of S0..S9 and Y0..Y9, 0 = not supported
+static const uint32_t nominal_bitrates[10] = {10000, 20000, 50000, 100000, 125000,
+                                              250000, 500000, 800000, 1000000, 83333};
+static const uint32_t data_bitrates[10] = {500000, 1000000, 2000000, 0, 4000000, 5000000, 0, 0, 8000000, 0};
+
+// Parses n hex digits, returns false on anything else
+static bool parse_hex(const char *s, size_t n, uint32_t &value)
+{
+    value = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        uint8_t v = hex_table.value[(uint8_t)s[i]];
+        if (v & 0xF0)
+            return false;
+        value = (value << 4) | v;
+    }
+    return true;
+}
+
+static void append_hex(std::string &out, uint32_t value, int digits)
+{
+    for (int i = digits - 1; i >= 0; i--)
+    {
+        out += hex_upper[(value >> (4 * i)) & 0x0F];
+    }
+}
+
+struct SimFrame
+{
+    char type; // t, T, r, R, d, D, b, B as on the wire
+    uint32_t id;
+    uint8_t dlc;
+    uint8_t len;
+    uint8_t data[64];
+    bool esi;           // CAN FD sender was error passive
+    int marker;         // Tx echo marker or -1
+    uint64_t queued_ns; // When the frame entered the Tx buffer
+};
+
+struct MaskFilter
+{
+    uint32_t id;
+    uint32_t mask;
+    bool extended;
+};
+
+static volatile sig_atomic_t quit_requested = 0;
+
+static void handle_signal(int)
+{
+    quit_requested = 1;
+}
+
+class SlcanSimulator
+{
+private:
+    static const size_t TX_BUFFER_FRAMES = 67;      // Like the firmware's CAN Tx buffer
+    static const size_t USB_IN_BUFFER = 256 * 1024; // Pending output before frames are dropped
+    static const uint32_t CAN_CLOCK = 160000000;
+    static const uint64_t ERROR_REPORT_MIN_NS = 100000000;
+    static const uint64_t ERROR_REPORT_REPEAT_NS = 3000000000ull;
+
+    // Results of a command besides the feedback code characters
+    static const int FBK_NONE = -1; // Not answered with #
+    static const int FBK_OK = 0;
+
+    int master;
+    int slave; // Kept open so the master never sees a hangup
+    std::string slave_path;
+    bool verbose;
+
+    // Adapter settings, reset by C
+    bool is_open;
+    char open_mode; // N = normal, S = silent, I = internal / E = external loopback
+    bool silent_default;
+    uint32_t nominal_bitrate;
+    uint32_t data_bitrate;
+    bool feedback;
+    bool markers;
+    bool error_reports;
+    bool esi_reports;
+    unsigned bus_load_interval; // In 100 ms, 0 = off
+    std::vector<MaskFilter> filters;
+
+    // Bus state
+    int bus_status; // 0 = active, 1 = warning, 2 = passive, 3 = bus off
+    int last_protocol_error;
+    uint8_t firmware_flags; // Latched until the next error report
+    uint8_t tx_errors;
+    uint8_t rx_errors;
+    bool error_changed;
+    uint64_t last_error_report;
+    std::deque<SimFrame> tx_buffer;
+    uint64_t bus_free_at;
+    uint64_t busy_ns; // Bus time used since the last load report
+    uint64_t next_load_report;
+
+    // Generated RX traffic
+    double rx_rate;
+    char rx_type;
+    unsigned rx_len;
+    unsigned rx_ids;
+    bool rx_esi; // The other nodes are error passive
+    uint64_t rx_start;
+    uint64_t rx_generated;
+    uint32_t rx_counter;
+
+    // Host link
+    std::string in_buf;
+    std::string out_buf;
+    size_t out_pos;
+
+    // Statistics
+    uint64_t commands;
+    uint64_t tx_frames;
+    uint64_t rx_frames;
+    uint64_t tx_rejected;
+    uint64_t rx_dropped;
+
+    void reply(const std::string &text)
+    {
+        // A full USB IN buffer drops the message like the firmware does
+        if (out_buf.size() - out_pos + text.size() + 1 > USB_IN_BUFFER)
+        {
+            if (!(firmware_flags & 0x08))
+                error_changed = true;
+            firmware_flags |= 0x08;
+            rx_dropped++;
+            return;
+        }
+        out_buf += text;
+        out_buf += '\r';
+    }
+
+    void flush_output()
+    {
+        while (out_pos < out_buf.size())
+        {
+            ssize_t n = write(master, out_buf.data() + out_pos, out_buf.size() - out_pos);
+            if (n <= 0)
+                break;
+            out_pos += n;
+        }
+        if (out_pos == out_buf.size())
+        {
+            out_buf.clear();
+            out_pos = 0;
+        }
+        else if (out_pos > USB_IN_BUFFER)
+        {
+            out_buf.erase(0, out_pos);
+            out_pos = 0;
+        }
+    }
+
+    void reset_settings()
+    {
+        is_open = false;
+        open_mode = 'N';
+        silent_default = false;
+        nominal_bitrate = 0;
+        data_bitrate = 0;
+        feedback = false;
+        markers = false;
+        error_reports = false;
+        esi_reports = false;
+        bus_load_interval = 0;
+        filters.clear();
+        tx_buffer.clear();
+    }
+
+    // Approximate time on the bus, bit stuffing is ignored. CAN FD sends the
+    // arbitration phase with the nominal and, with BRS, the data phase with
+    // the data bitrate.
+    uint64_t frame_ns(const SimFrame &frame) const
+    {
+        bool extended = (frame.type >= 'A' && frame.type <= 'Z');
+        bool fd = strchr("dDbB", frame.type) != nullptr;
+        bool brs = (frame.type == 'b' || frame.type == 'B');
+        uint32_t nominal = nominal_bitrate ? nominal_bitrate : 500000;
+        uint32_t data = (brs && data_bitrate) ? data_bitrate : nominal;
+
+        if (!fd)
+        {
+            uint64_t bits = (extended ? 67 : 47) + 8 * (uint64_t)frame.len;
+            return bits * 1000000000ull / nominal;
+        }
+        uint64_t arbitration = extended ? 50 : 30;
+        uint64_t data_bits = 8 * (uint64_t)frame.len + (frame.len > 16 ? 26 : 22);
+        return arbitration * 1000000000ull / nominal + data_bits * 1000000000ull / data;
+    }
+
+    bool passes_filters(const SimFrame &frame) const
+    {
+        if (filters.empty())
+            return true;
+        bool extended = (frame.type >= 'A' && frame.type <= 'Z');
+        for (size_t i = 0; i < filters.size(); i++)
+        {
+            if (filters[i].extended == extended && (frame.id & filters[i].mask) == (filters[i].id & filters[i].mask))
+                return true;
+        }
+        return false;
+    }
+
+    // Sends a frame from the bus to the host
+    void receive(const SimFrame &frame)
+    {
+        if (!passes_filters(frame))
+            return;
+
+        std::string text(1, frame.type);
+        append_hex(text, frame.id, (frame.type >= 'a') ? 3 : 8);
+        text += hex_upper[frame.dlc];
+        for (unsigned i = 0; i < frame.len; i++)
+        {
+            append_hex(text, frame.data[i], 2);
+        }
+        if (esi_reports && frame.esi && strchr("dDbB", frame.type))
+        {
+            text += 'S';
+        }
+        reply(text);
+        rx_frames++;
+    }
+
+    void send_error_report(uint64_t now)
+    {
+        std::string text = "E";
+        text += hex_upper[bus_status & 0x0F];
+        text += hex_upper[last_protocol_error & 0x0F];
+        append_hex(text, firmware_flags, 2);
+        append_hex(text, tx_errors, 2);
+        append_hex(text, rx_errors, 2);
+        reply(text);
+        firmware_flags = 0;
+        error_changed = false;
+        last_error_report = now;
+    }
+
+    bool errors_present() const
+    {
+        return bus_status != 0 || last_protocol_error != 0 || firmware_flags != 0 || tx_errors || rx_errors;
+    }
+
+    // s / y command: Prescaler, Seg1, Seg2, SJW
+    bool parse_bit_timing(const std::string &args, const unsigned *limits, uint32_t &bitrate)
+    {
+        unsigned v[4];
+        if (sscanf(args.c_str(), "%u,%u,%u,%u", &v[0], &v[1], &v[2], &v[3]) != 4)
+            return false;
+        for (int i = 0; i < 4; i++)
+        {
+            if (v[i] == 0 || v[i] > limits[i])
+                return false;
+        }
+        bitrate = CAN_CLOCK / (v[0] * (1 + v[1] + v[2]));
+        return true;
+    }
+
+    // F<id>,<mask>[;<id>,<mask>...] with 3 or 8 digit IDs
+    bool parse_filters(const std::string &args)
+    {
+        std::vector<MaskFilter> parsed;
+        size_t pos = 0;
+        while (pos < args.size())
+        {
+            size_t end = args.find(';', pos);
+            if (end == std::string::npos)
+                end = args.size();
+            std::string item = args.substr(pos, end - pos);
+            size_t comma = item.find(',');
+            if (comma == std::string::npos || (comma != 3 && comma != 8) || item.size() != 2 * comma + 1)
+                return false;
+
+            MaskFilter filter;
+            filter.extended = (comma == 8);
+            if (!parse_hex(item.c_str(), comma, filter.id) || !parse_hex(item.c_str() + comma + 1, comma, filter.mask))
+                return false;
+            parsed.push_back(filter);
+            pos = end + 1;
+        }
+        if (parsed.empty() || parsed.size() > 8)
+            return false;
+        filters = parsed;
+        return true;
+    }
+
+    int transmit(const std::string &cmd, uint64_t now)
+    {
+        SimFrame frame;
+        frame.type = cmd[0];
+        frame.esi = false;
+        frame.marker = -1;
+        frame.queued_ns = now;
+        bool rtr = (frame.type == 'r' || frame.type == 'R');
+        bool fd = strchr("dDbB", frame.type) != nullptr;
+        size_t id_digits = (frame.type >= 'a') ? 3 : 8;
+
+        uint32_t value;
+        if (cmd.size() < id_digits + 2 || !parse_hex(cmd.c_str() + 1, id_digits, frame.id) ||
+            !parse_hex(cmd.c_str() + 1 + id_digits, 1, value))
+        {
+            return '2';
+        }
+        frame.dlc = (uint8_t)value;
+        frame.len = fd ? dlc_to_len[frame.dlc] : (frame.dlc > 8 ? 8 : frame.dlc);
+        if ((id_digits == 3 && frame.id > 0x7FF) || frame.id > 0x1FFFFFFF || (fd && rtr))
+        {
+            return '2';
+        }
+
+        size_t pos = id_digits + 2;
+        size_t data_chars = rtr ? 0 : 2 * frame.len;
+        if (cmd.size() != pos + data_chars && !(markers && cmd.size() == pos + data_chars + 2))
+        {
+            return '2';
+        }
+        for (unsigned i = 0; i < (rtr ? 0u : frame.len); i++)
+        {
+            if (!parse_hex(cmd.c_str() + pos + 2 * i, 2, value))
+                return '2';
+            frame.data[i] = (uint8_t)value;
+        }
+        if (cmd.size() == pos + data_chars + 2)
+        {
+            if (!parse_hex(cmd.c_str() + pos + data_chars, 2, value))
+                return '2';
+            frame.marker = (int)value;
+        }
+
+        if (!is_open)
+            return '3';
+        if (fd && !data_bitrate)
+            return ':';
+        if (open_mode == 'S')
+            return '9';
+        if (bus_status == 3)
+            return '8';
+        if (tx_buffer.size() >= TX_BUFFER_FRAMES)
+        {
+            if (!(firmware_flags & 0x04))
+                error_changed = true;
+            firmware_flags |= 0x04;
+            tx_rejected++;
+            return '7';
+        }
+        tx_buffer.push_back(frame);
+        return FBK_OK;
+    }
+
+    int execute(const std::string &cmd, uint64_t now)
+    {
+        if (cmd.empty())
+            return FBK_NONE;
+
+        bool closed = !is_open;
+        std::string args = cmd.substr(1);
+        switch (cmd[0])
+        {
+        case 'V':
+            if (cmd.size() != 1)
+                return '1';
+            reply("+Board: Simulator\tMCU: PTY\tDevID: 0\tFirmware: 2427156\tSlcan: 100\tClock: 160\t"
+                  "Limits: 512,256,128,128,32,32,16,16");
+            return FBK_NONE;
+
+        case 'S':
+            if (!closed)
+                return '4';
+            if (args.size() != 1 || args[0] < '0' || args[0] > '9')
+                return '2';
+            nominal_bitrate = nominal_bitrates[args[0] - '0'];
+            return FBK_OK;
+
+        case 'Y':
+            if (!closed)
+                return '4';
+            if (args.size() != 1 || args[0] < '0' || args[0] > '9' || !data_bitrates[args[0] - '0'])
+                return '2';
+            data_bitrate = data_bitrates[args[0] - '0'];
+            return FBK_OK;
+
+        case 's':
+        case 'y':
+        {
+            static const unsigned nominal_limits[4] = {512, 256, 128, 128};
+            static const unsigned data_limits[4] = {32, 32, 16, 16};
+            if (!closed)
+                return '4';
+            uint32_t bitrate;
+            if (!parse_bit_timing(args, cmd[0] == 's' ? nominal_limits : data_limits, bitrate))
+                return '2';
+            (cmd[0] == 's' ? nominal_bitrate : data_bitrate) = bitrate;
+            return FBK_OK;
+        }
+
+        case 'O':
+            if (!closed)
+                return '4';
+            if (args.size() > 1 || (args.size() == 1 && !strchr("NSIE", args[0])))
+                return '2';
+            if (!nominal_bitrate)
+                return ':';
+            is_open = true;
+            open_mode = args.empty() ? (silent_default ? 'S' : 'N') : args[0];
+            bus_free_at = now;
+            busy_ns = 0;
+            next_load_report = now + bus_load_interval * 100000000ull;
+            rx_start = now;
+            rx_generated = 0;
+            return FBK_OK;
+
+        case 'L':
+        {
+            // Legacy: open in listen only mode, 2.5: bus load report interval
+            if (args.empty())
+            {
+                if (!closed)
+                    return '4';
+                if (!nominal_bitrate)
+                    return ':';
+                is_open = true;
+                open_mode = 'S';
+                rx_start = now;
+                rx_generated = 0;
+                return FBK_OK;
+            }
+            char *end;
+            unsigned long interval = strtoul(args.c_str(), &end, 10);
+            if (*end || interval > 100)
+                return '2';
+            bus_load_interval = (unsigned)interval;
+            busy_ns = 0;
+            next_load_report = now + interval * 100000000ull;
+            return FBK_OK;
+        }
+
+        case 'C':
+            // Closes and resets everything, including feedback mode
+            reset_settings();
+            return FBK_NONE;
+
+        case 'M':
+            if (args == "0" || args == "1")
+            {
+                if (!closed)
+                    return '4';
+                silent_default = (args == "1");
+                return FBK_OK;
+            }
+            if (args.empty())
+                return '2';
+            for (size_t i = 0; i < args.size(); i++)
+            {
+                bool on = (args[i] >= 'A' && args[i] <= 'Z');
+                switch (args[i])
+                {
+                case 'A':
+                case 'a':
+                    if (!closed)
+                        return '4';
+                    break;
+                case 'D':
+                case 'd':
+                case 'I':
+                case 'i':
+                case 'R':
+                case 'r':
+                    break;
+                case 'E':
+                case 'e':
+                    error_reports = on;
+                    break;
+                case 'F':
+                case 'f':
+                    feedback = on;
+                    break;
+                case 'M':
+                case 'm':
+                    markers = on;
+                    break;
+                case 'S':
+                case 's':
+                    esi_reports = on;
+                    break;
+                default:
+                    return '2';
+                }
+            }
+            return FBK_OK;
+
+        case 'A':
+            if (!closed)
+                return '4';
+            return (args == "0" || args == "1") ? FBK_OK : '2';
+
+        case 'F':
+            if (args.empty())
+            {
+                // Legacy status request: always answered with a report
+                send_error_report(now);
+                return FBK_OK;
+            }
+            if (!closed)
+                return '4';
+            return parse_filters(args) ? FBK_OK : '2';
+
+        case 'f':
+            if (!closed)
+                return '4';
+            filters.clear();
+            return FBK_OK;
+
+        case '*':
+            if (args == "Boot0:?")
+            {
+                reply("+0");
+                return FBK_NONE;
+            }
+            if (args == "Boot0:Off")
+                return closed ? FBK_OK : '4';
+            if (args == "DFU")
+                return '6';
+            return '1';
+
+        case 't':
+        case 'T':
+        case 'r':
+        case 'R':
+        case 'd':
+        case 'D':
+        case 'b':
+        case 'B':
+            return transmit(cmd, now);
+
+        default:
+            return '1';
+        }
+    }
+
+    void handle_command(const std::string &cmd, uint64_t now)
+    {
+        commands++;
+        if (verbose)
+        {
+            std::cerr << "[HOST] " << cmd << std::endl;
+        }
+        int result = execute(cmd, now);
+
+        // MF is the first command that is answered, Mf the first that is not
+        if (feedback && result != FBK_NONE)
+        {
+            reply(result == FBK_OK ? std::string("#") : std::string("#") + (char)result);
+        }
+    }
+
+    void generate_frame(SimFrame &frame)
+    {
+        frame.type = rx_type;
+        bool extended = (rx_type >= 'A' && rx_type <= 'Z');
+        uint32_t base = extended ? 0x18DA0000 : 0x100;
+        frame.id = base + rx_counter % rx_ids;
+        frame.esi = rx_esi;
+        frame.marker = -1;
+
+        bool fd = strchr("dDbB", rx_type) != nullptr;
+        frame.dlc = len_to_dlc[rx_len > 64 ? 64 : rx_len];
+        if (!fd && frame.dlc > 8)
+        {
+            frame.dlc = 8;
+        }
+        frame.len = dlc_to_len[frame.dlc];
+
+        // Counter in the first 4 bytes, a pattern after it
+        for (unsigned i = 0; i < frame.len; i++)
+        {
+            frame.data[i] = (i < 4) ? (uint8_t)(rx_counter >> (24 - 8 * i)) : (uint8_t)(i * 0x11);
+        }
+        rx_counter++;
+    }
+
+    void tick(uint64_t now)
+    {
+        // Frames leave the Tx buffer one after the other at bus speed
+        while (!tx_buffer.empty())
+        {
+            const SimFrame &frame = tx_buffer.front();
+            uint64_t start = bus_free_at > frame.queued_ns ? bus_free_at : frame.queued_ns;
+            uint64_t duration = frame_ns(frame);
+            if (start + duration > now)
+                break;
+            bus_free_at = start + duration;
+            busy_ns += duration;
+            tx_frames++;
+            if (markers && frame.marker >= 0)
+            {
+                std::string echo = "M";
+                append_hex(echo, frame.marker, 2);
+                reply(echo);
+            }
+            if (open_mode == 'I' || open_mode == 'E')
+            {
+                // The adapter is the sender of its own frames
+                SimFrame looped = frame;
+                looped.esi = (bus_status == 2);
+                receive(looped);
+            }
+            tx_buffer.pop_front();
+        }
+
+        // Traffic of the other nodes on the bus
+        if (is_open && bus_status != 3 && rx_rate > 0)
+        {
+            uint64_t due = (uint64_t)((now - rx_start) / 1e9 * rx_rate);
+            if (due - rx_generated > rx_rate)
+            {
+                rx_generated = due - (uint64_t)rx_rate; // Do not catch up more than one second
+            }
+            SimFrame frame;
+            for (; rx_generated < due; rx_generated++)
+            {
+                generate_frame(frame);
+                busy_ns += frame_ns(frame);
+                receive(frame);
+            }
+        }
+
+        if (is_open && bus_load_interval && now >= next_load_report)
+        {
+            uint64_t interval = bus_load_interval * 100000000ull;
+            uint64_t load = busy_ns * 100 / interval;
+            if (load > 0)
+            {
+                reply("L" + std::to_string(load > 100 ? 100 : load));
+            }
+            busy_ns = 0;
+            next_load_report = now + interval;
+        }
+
+        if (error_reports && errors_present())
+        {
+            uint64_t since = now - last_error_report;
+            if ((error_changed && since >= ERROR_REPORT_MIN_NS) || since >= ERROR_REPORT_REPEAT_NS)
+            {
+                send_error_report(now);
+            }
+        }
+    }
+
+    void set_bus_status(int status, uint8_t tec)
+    {
+        bus_status = status;
+        tx_errors = tec;
+        error_changed = true;
+        if (status == 3)
+        {
+            tx_buffer.clear();
+        }
+    }
+
+public:
+    SlcanSimulator()
+        : master(-1), slave(-1), verbose(false), is_open(false), open_mode('N'), silent_default(false),
+          nominal_bitrate(0), data_bitrate(0), feedback(false), markers(false), error_reports(false),
+          esi_reports(false), bus_load_interval(0), bus_status(0), last_protocol_error(0), firmware_flags(0),
+          tx_errors(0), rx_errors(0), error_changed(false), last_error_report(0), bus_free_at(0), busy_ns(0),
+          next_load_report(0), rx_rate(0), rx_type('t'), rx_len(8), rx_ids(16), rx_esi(false), rx_start(0),
+          rx_generated(0), rx_counter(0), out_pos(0), commands(0), tx_frames(0), rx_frames(0), tx_rejected(0), rx_dropped(0) {}
+
+    ~SlcanSimulator()
+    {
+        if (slave >= 0)
+            close(slave);
+        if (master >= 0)
+            close(master);
+    }
+
+    bool open_pty()
+    {
+        master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+        if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0)
+        {
+            perror("posix_openpt");
+            return false;
+        }
+        const char *name = ptsname(master);
+        if (!name)
+        {
+            perror("ptsname");
+            return false;
+        }
+        slave_path = name;
+
+        // Raw until the terminal sets up the port, so nothing is echoed back
+        slave = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+        if (slave < 0)
+        {
+            perror(name);
+            return false;
+        }
+        struct termios tty;
+        if (tcgetattr(slave, &tty) == 0)
+        {
+            cfmakeraw(&tty);
+            tcsetattr(slave, TCSANOW, &tty);
+        }
+        return true;
+    }
+
+    const std::string &path() const
+    {
+        return slave_path;
+    }
+
+    void set_verbose(bool on)
+    {
+        verbose = on;
+    }
+
+    void set_traffic(double rate, char type, unsigned len, unsigned ids)
+    {
+        rx_rate = rate;
+        rx_type = type;
+        rx_len = len;
+        rx_ids = ids ? ids : 1;
+        rx_start = monotonic_ns();
+        rx_generated = 0;
+    }
+
+    // Control commands from stdin to change the traffic and inject errors
+    void control(const std::string &line)
+    {
+        std::istringstream words(line);
+        std::string word;
+        if (!(words >> word))
+            return;
+
+        if (word == "rate" || word == "type" || word == "len" || word == "ids")
+        {
+            std::string value;
+            if (!(words >> value))
+            {
+                std::cerr << "Error: Missing value for " << word << std::endl;
+                return;
+            }
+            double rate = rx_rate;
+            char type = rx_type;
+            unsigned len = rx_len;
+            unsigned ids = rx_ids;
+            if (word == "rate")
+                rate = atof(value.c_str());
+            else if (word == "type" && value.size() == 1 && strchr("tTdDbB", value[0]))
+                type = value[0];
+            else if (word == "len" && atoi(value.c_str()) >= 0 && atoi(value.c_str()) <= 64)
+                len = atoi(value.c_str());
+            else if (word == "ids" && atoi(value.c_str()) > 0)
+                ids = atoi(value.c_str());
+            else
+            {
+                std::cerr << "Error: Invalid value: " << value << std::endl;
+                return;
+            }
+            set_traffic(rate, type, len, ids);
+        }
+        else if (word == "esi" && (words >> word) && (word == "on" || word == "off"))
+            rx_esi = (word == "on");
+        else if (word == "busoff")
+            set_bus_status(3, 255);
+        else if (word == "passive")
+            set_bus_status(2, 128);
+        else if (word == "warning")
+            set_bus_status(1, 96);
+        else if (word == "recover")
+        {
+            set_bus_status(0, 0);
+            last_protocol_error = 0;
+            rx_errors = 0;
+        }
+        else if (word == "noack")
+        {
+            last_protocol_error = 3;
+            firmware_flags |= 0x02;
+            error_changed = true;
+        }
+        else if (word == "overflow")
+        {
+            firmware_flags |= 0x08;
+            error_changed = true;
+        }
+        else if (word == "stats")
+        {
+            std::cerr << "Commands: " << commands << ", TX frames: " << tx_frames << " (" << tx_rejected
+                      << " rejected), RX frames: " << rx_frames << " (" << rx_dropped << " dropped)" << std::endl;
+        }
+        else if (word == "quit" || word == "exit")
+            quit_requested = 1;
+        else
+        {
+            std::cerr << "Control commands: rate <fps>, type <t|T|d|D|b|B>, len <n>, ids <n>," << std::endl;
+            std::cerr << "  esi <on|off>, busoff, passive, warning, recover, noack, overflow, stats, quit" << std::endl;
+        }
+    }
+
+    void run()
+    {
+        std::string control_buf;
+        bool control_open = true;
+
+        while (!quit_requested)
+        {
+            bool busy = is_open && (rx_rate > 0 || !tx_buffer.empty());
+            struct pollfd pfds[2];
+            pfds[0].fd = master;
+            pfds[0].events = POLLIN | (out_pos < out_buf.size() ? POLLOUT : 0);
+            pfds[0].revents = 0;
+            pfds[1].fd = control_open ? STDIN_FILENO : -1;
+            pfds[1].events = POLLIN;
+            pfds[1].revents = 0;
+            if (poll(pfds, 2, busy ? 1 : 100) < 0 && errno != EINTR)
+            {
+                perror("poll");
+                break;
+            }
+            uint64_t now = monotonic_ns();
+
+            if (pfds[0].revents & POLLIN)
+            {
+                char buf[65536];
+                ssize_t n = read(master, buf, sizeof(buf));
+                if (n > 0)
+                {
+                    in_buf.append(buf, n);
+                }
+                size_t start = 0;
+                size_t cr;
+                while ((cr = in_buf.find('\r', start)) != std::string::npos)
+                {
+                    std::string cmd = in_buf.substr(start, cr - start);
+                    if (!cmd.empty() && cmd[0] == '\n')
+                        cmd.erase(0, 1);
+                    handle_command(cmd, now);
+                    start = cr + 1;
+                }
+                in_buf.erase(0, start);
+            }
+
+            if (pfds[1].revents & (POLLIN | POLLHUP))
+            {
+                char buf[1024];
+                ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+                if (n <= 0)
+                {
+                    control_open = false;
+                }
+                else
+                {
+                    control_buf.append(buf, n);
+                    size_t nl;
+                    while ((nl = control_buf.find('\n')) != std::string::npos)
+                    {
+                        control(control_buf.substr(0, nl));
+                        control_buf.erase(0, nl + 1);
+                    }
+                }
+            }
+
+            tick(now);
+            flush_output();
+        }
+
+        std::cerr << "Commands: " << commands << ", TX frames: " << tx_frames << " (" << tx_rejected
+                  << " rejected), RX frames: " << rx_frames << " (" << rx_dropped << " dropped)" << std::endl;
+    }
+};
+
+void print_usage(const char *prg)
+{
+    std::cerr << prg << " - Simulated SLCAN adapter (CANable 2.5 protocol) on a pseudo terminal\n"
+              << std::endl;
+    std::cerr << "Usage: " << prg << " [options]\n"
+              << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  -h, --help            Show this help message" << std::endl;
+    std::cerr << "  -l, --link <path>     Create a symlink to the pseudo terminal, e.g. /tmp/slcan0" << std::endl;
+    std::cerr << "  -r, --rate <fps>      Frames per second received from the simulated bus (default 0)" << std::endl;
+    std::cerr << "  -t, --type <c>        Type of the received frames: t, T, d, D, b or B (default t)" << std::endl;
+    std::cerr << "  -n, --len <n>         Data bytes of the received frames, 0-64 (default 8)" << std::endl;
+    std::cerr << "      --ids <n>         Number of different IDs of the received frames (default 16)" << std::endl;
+    std::cerr << "  -v, --verbose         Print every command from the host" << std::endl;
+    std::cerr << "\nControl commands on stdin:" << std::endl;
+    std::cerr << "  rate <fps>, type <c>, len <n>, ids <n>   Change the received traffic" << std::endl;
+    std::cerr << "  esi on|off                                Received CAN FD frames from error passive senders" << std::endl;
+    std::cerr << "  busoff, passive, warning, recover         Change the bus status" << std::endl;
+    std::cerr << "  noack, overflow                           Report a missing ACK / USB IN buffer overflow" << std::endl;
+    std::cerr << "  stats, quit" << std::endl;
+    std::cerr << "\nExample:" << std::endl;
+    std::cerr << "  " << prg << " -l /tmp/slcan0 -r 5000 -t b -n 64 &" << std::endl;
+    std::cerr << "  slcan_terminal -i C,MF,MM,ME,S8,Y4,ON /tmp/slcan0" << std::endl;
+}
+
+// Values for options that only have a long form
+enum LongOption
+{
+    OPT_IDS = 256,
+};
+
+int main(int argc, char **argv)
+{
+    int opt;
+    std::string link_path;
+    double rate = 0;
+    char type = 't';
+    long len = 8;
+    long ids = 16;
+    bool verbose = false;
+
+    static struct option long_options[] = {
+        {"help", no_argument, 0, 'h'},
+        {"link", required_argument, 0, 'l'},
+        {"rate", required_argument, 0, 'r'},
+        {"type", required_argument, 0, 't'},
+        {"len", required_argument, 0, 'n'},
+        {"ids", required_argument, 0, OPT_IDS},
+        {"verbose", no_argument, 0, 'v'},
+        {0, 0, 0, 0}};
+
+    while ((opt = getopt_long(argc, argv, "hl:r:t:n:v", long_options, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+        case 'h':
+            print_usage(argv[0]);
+            return 0;
+        case 'l':
+            link_path = optarg;
+            break;
+        case 'r':
+            rate = atof(optarg);
+            if (rate < 0)
+            {
+                std::cerr << "Error: Invalid rate: " << optarg << std::endl;
+                return 1;
+            }
+            break;
+        case 't':
+            if (strlen(optarg) != 1 || !strchr("tTdDbB", optarg[0]))
+            {
+                std::cerr << "Error: Invalid frame type: " << optarg << std::endl;
+                return 1;
+            }
+            type = optarg[0];
+            break;
+        case 'n':
+            len = strtol(optarg, nullptr, 10);
+            if (len < 0 || len > 64)
+            {
+                std::cerr << "Error: Invalid length (0-64): " << optarg << std::endl;
+                return 1;
+            }
+            break;
+        case OPT_IDS:
+            ids = strtol(optarg, nullptr, 10);
+            if (ids <= 0)
+            {
+                std::cerr << "Error: Invalid number of IDs: " << optarg << std::endl;
+                return 1;
+            }
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    SlcanSimulator sim;
+    if (!sim.open_pty())
+    {
+        return 1;
+    }
+    sim.set_verbose(verbose);
+    sim.set_traffic(rate, type, (unsigned)len, (unsigned)ids);
+
+    if (!link_path.empty())
+    {
+        // Replace a stale link, but never a regular file
+        struct stat st;
+        if (lstat(link_path.c_str(), &st) == 0 && S_ISLNK(st.st_mode))
+        {
+            unlink(link_path.c_str());
+        }
+        if (symlink(sim.path().c_str(), link_path.c_str()) < 0)
+        {
+            perror(link_path.c_str());
+            return 1;
+        }
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    std::cout << "Simulated SLCAN adapter on " << sim.path();
+    if (!link_path.empty())
+    {
+        std::cout << " (" << link_path << ")";
+    }
+    std::cout << std::endl;
+
+    sim.run();
+
+    if (!link_path.empty())
+    {
+        unlink(link_path.c_str());
+    }
+    return 0;
+}
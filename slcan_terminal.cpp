@@ -10,8 +10,12 @@
 #include <fstream>
 #include <string>
 #include <vector>
+#include <deque>
+#include <unordered_map>
 #include <thread>
+#include <pthread.h>
 #include <atomic>
+#include <mutex>
 #include <fcntl.h>
 #include <termios.h>
 #include <unistd.h>
@@ -19,739 +23,5918 @@
 #include <sys/select.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <errno.h>
 #include <linux/serial.h>
 #include <cstring>
+#include <strings.h>
 #include <cstdio>
 #include <cstdlib>
 #include <getopt.h>
 #include <sstream>
 #include <dirent.h>
+#include <signal.h>
 #include <algorithm>
+#include <memory>
+#include <stdint.h>
+#include <time.h>
 
-class SlcanTerminal
+#include "slcan.h"
+#include "slcan_shm.h"
+
+// Per-command flags of the TX path
+enum TxFlags
+{
+    TX_FLAG_FRAME = 0x01,    // CAN frame, passes the adapter's Tx buffer
+    TX_FLAG_FEEDBACK = 0x02, // The adapter answers with # or +text (feedback mode)
+    TX_FLAG_CREDIT = 0x04,   // Occupies the send window until released
+};
+
+// Bounded lock-free multi-producer / single-consumer queue of encoded SLCAN
+// commands. Every slot carries a sequence number that tells producers and the
+// consumer whose turn it is, so no locks are taken on either side.
+class TxQueue
 {
+public:
+    static const size_t SLOT_SIZE = 256; // Longest command incl. \r
+
+    struct Slot
+    {
+        std::atomic<size_t> seq;
+        uint16_t len;
+        int16_t marker; // Tx echo marker of the frame or -1
+        uint8_t flags;  // TxFlags
+        char data[SLOT_SIZE];
+    };
+
 private:
-    std::string tty_path;
-    int fd;
-    std::atomic<bool> running;
-    struct termios old_tty_settings;
-    struct termios old_stdin_settings;
+    std::vector<Slot> slots;
+    size_t mask;
+    std::atomic<size_t> enqueue_pos;
+    size_t dequeue_pos; // Only touched by the consumer
 
-    void setup_serial_port()
+public:
+    // capacity must be a power of two
+    explicit TxQueue(size_t capacity) : slots(capacity), mask(capacity - 1), enqueue_pos(0), dequeue_pos(0)
     {
-        struct termios tty;
+        for (size_t i = 0; i < capacity; i++)
+        {
+            slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
 
-        // Get current settings
-        if (tcgetattr(fd, &tty) < 0)
+    // Returns false if the queue is full or the command does not fit in a slot
+    bool push(const char *data, size_t len, int marker = -1, uint8_t flags = 0)
+    {
+        if (len > SLOT_SIZE)
         {
-            perror("tcgetattr");
-            exit(EXIT_FAILURE);
+            return false;
         }
 
-        // Save old settings
-        old_tty_settings = tty;
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        Slot *slot;
+        for (;;)
+        {
+            slot = &slots[pos & mask];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false; // Full
+            }
+            else
+            {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
 
-        // Configure serial port for raw mode
-        cfmakeraw(&tty);
+        memcpy(slot->data, data, len);
+        slot->len = (uint16_t)len;
+        slot->marker = (int16_t)marker;
+        slot->flags = flags;
+        slot->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
 
-        // Set baud rate to 115200 (common for SLCAN devices)
-        cfsetospeed(&tty, B115200);
-        cfsetispeed(&tty, B115200);
+    // Consumer side: oldest published command or nullptr if empty
+    const Slot *front()
+    {
+        Slot *slot = &slots[dequeue_pos & mask];
+        if (slot->seq.load(std::memory_order_acquire) != dequeue_pos + 1)
+        {
+            return nullptr;
+        }
+        return slot;
+    }
 
-        // 8N1 mode
-        tty.c_cflag &= ~PARENB; // No parity
-        tty.c_cflag &= ~CSTOPB; // 1 stop bit
-        tty.c_cflag &= ~CSIZE;
-        tty.c_cflag |= CS8;            // 8 data bits
-        tty.c_cflag |= CREAD | CLOCAL; // Enable receiver, ignore modem control
+    // Consumer side: releases the slot returned by front()
+    void pop()
+    {
+        slots[dequeue_pos & mask].seq.store(dequeue_pos + mask + 1, std::memory_order_release);
+        dequeue_pos++;
+    }
+};
 
-        // No hardware flow control
-        tty.c_cflag &= ~CRTSCTS;
+static inline void signal_eventfd(int efd)
+{
+    if (efd >= 0)
+    {
+        uint64_t one = 1;
+        ssize_t r = write(efd, &one, sizeof(one));
+        (void)r;
+    }
+}
 
-        // No software flow control
-        tty.c_iflag &= ~(IXON | IXOFF | IXANY);
+// Writes the whole buffer to a non-blocking fd, waiting for POLLOUT when the
+// driver buffer is full. Returns false on error or after timeout_ms of no progress.
+static bool write_all(int fd, const char *data, size_t len, int timeout_ms = 1000)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n > 0)
+        {
+            data += n;
+            len -= n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN)
+        {
+            return false;
+        }
 
-        // Raw output
-        tty.c_oflag &= ~OPOST;
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, timeout_ms) <= 0)
+        {
+            errno = ETIMEDOUT;
+            return false;
+        }
+    }
+    return true;
+}
 
-        // Non-canonical mode, no echo
-        tty.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
+// Bounded lock-free single-producer / single-consumer ring. The producer
+// only writes head, the consumer only writes tail; the padding keeps the two
+// counters on separate cache lines.
+template <typename T>
+class SpscRing
+{
+private:
+    std::vector<T> items;
+    size_t mask;
+    char pad0[64];
+    std::atomic<size_t> head; // Next slot to write (producer)
+    char pad1[64];
+    std::atomic<size_t> tail; // Next slot to read (consumer)
+    char pad2[64];
 
-        // Read timeout settings
-        tty.c_cc[VMIN] = 0;  // Non-blocking
-        tty.c_cc[VTIME] = 1; // 0.1 second timeout
+public:
+    // capacity must be a power of two
+    explicit SpscRing(size_t capacity) : items(capacity), mask(capacity - 1), head(0), tail(0) {}
 
-        if (tcsetattr(fd, TCSANOW, &tty) < 0)
+    bool push(const T &item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) > mask)
         {
-            perror("tcsetattr");
-            exit(EXIT_FAILURE);
+            return false; // Full
         }
+        items[h & mask] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
 
-        // Flush any existing data
-        tcflush(fd, TCIOFLUSH);
+    // Producer side: true if push() would fail
+    bool full() const
+    {
+        return head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire) > mask;
     }
 
-    void setup_stdin()
+    // Consumer side: number of items ready to be read
+    size_t size() const
     {
-        struct termios tty;
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+    }
 
-        // Get current stdin settings
-        if (tcgetattr(STDIN_FILENO, &tty) < 0)
+    // Consumer side: i-th oldest item, i < size()
+    const T &peek(size_t i) const
+    {
+        return items[(tail.load(std::memory_order_relaxed) + i) & mask];
+    }
+
+    // Consumer side: releases the n oldest items
+    void consume(size_t n)
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + n, std::memory_order_release);
+    }
+
+    // Producer side: sequence number the next push() gets
+    size_t produced() const
+    {
+        return head.load(std::memory_order_relaxed);
+    }
+
+    // Sequence number of the oldest item, items before it are released
+    size_t consumed() const
+    {
+        return tail.load(std::memory_order_acquire);
+    }
+
+    bool pop(T &item)
+    {
+        if (size() == 0)
         {
-            perror("tcgetattr stdin");
-            exit(EXIT_FAILURE);
+            return false;
         }
+        item = peek(0);
+        consume(1);
+        return true;
+    }
+};
 
-        // Save old settings
-        old_stdin_settings = tty;
+// Console lines of the threads besides RX (TX, hotplug, file writers).
+// While the display thread runs it prints them between the received
+// records, or keeps them below the --stats/--sniff table, so no other
+// thread writes to the console. Rare, so a mutex is fine.
+class NoticeQueue
+{
+private:
+    std::mutex mutex;
+    std::deque<std::string> lines;
+    std::atomic<size_t> count;
+    std::atomic<int> wake_fd; // Display thread's eventfd, -1 before it exists
 
-        // Set stdin to raw mode for character-by-character input
-        tty.c_lflag &= ~(ICANON | ECHO);
-        tty.c_cc[VMIN] = 1;
-        tty.c_cc[VTIME] = 0;
+public:
+    NoticeQueue() : count(0), wake_fd(-1) {}
 
-        if (tcsetattr(STDIN_FILENO, TCSANOW, &tty) < 0)
+    void set_wake_fd(int fd)
+    {
+        wake_fd.store(fd, std::memory_order_release);
+    }
+
+    void post(const std::string &line)
+    {
         {
-            perror("tcsetattr stdin");
-            exit(EXIT_FAILURE);
+            std::lock_guard<std::mutex> lock(mutex);
+            lines.push_back(line);
+            count.fetch_add(1, std::memory_order_release);
         }
+        signal_eventfd(wake_fd.load(std::memory_order_acquire));
     }
 
-    void restore_stdin()
+    bool empty() const
     {
-        tcsetattr(STDIN_FILENO, TCSANOW, &old_stdin_settings);
+        return count.load(std::memory_order_acquire) == 0;
+    }
+
+    // Moves all waiting lines to the end of out
+    void take(std::deque<std::string> &out)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        out.insert(out.end(), lines.begin(), lines.end());
+        count.fetch_sub(lines.size(), std::memory_order_relaxed);
+        lines.clear();
+    }
+};
+
+// Longest line format_candump_line() writes for any of the interfaces
+static size_t candump_line_max(const std::vector<std::string> &ifaces)
+{
+    size_t longest = 0;
+    for (size_t i = 0; i < ifaces.size(); i++)
+    {
+        longest = std::max(longest, ifaces[i].size());
+    }
+    return 32 + longest + 160;
+}
+
+// Writes received frames to a candump log file. The RX thread only copies
+// frames into a preallocated ring; formatting and disk I/O happen on a
+// separate writer thread that drains the ring in large blocks. If the writer
+// falls behind, frames are dropped and counted instead of stalling RX.
+class CaptureLog
+{
+private:
+    static const size_t RING_SIZE = 64 * 1024;        // Frames
+    static const size_t WRITE_BLOCK = 256 * 1024;     // Bytes per write()
+    static const useconds_t DRAIN_INTERVAL_US = 20000; // Writer idle sleep
+
+    SpscRing<CanFrame> ring;
+    std::string path;
+    std::vector<std::string> ifaces; // Interface name of each channel
+    size_t line_max;                 // Room needed for one formatted frame
+    int file_fd;
+    int64_t wall_offset_ns;
+    std::atomic<bool> active;
+    std::atomic<uint64_t> dropped;
+    uint64_t written;
+    bool write_failed;
+    NoticeQueue *notices; // Reports of the writer go to the console through it
+    std::thread writer;
+
+    bool flush(std::vector<char> &block, size_t &len)
+    {
+        if (len > 0 && !write_failed)
+        {
+            if (!write_all(file_fd, &block[0], len))
+            {
+                notices->post("[ERR] Capture log " + path + ": " + strerror(errno) + " - logging stopped");
+                write_failed = true;
+            }
+        }
+        len = 0;
+        return !write_failed;
+    }
+
+    void writer_thread_func()
+    {
+        std::vector<char> block(WRITE_BLOCK);
+        size_t len = 0;
+        uint64_t reported_drops = 0;
+        uint64_t last_report = 0;
+
+        for (;;)
+        {
+            bool stopping = !active;
+            size_t count = ring.size();
+
+            for (size_t i = 0; i < count; i++)
+            {
+                if (block.size() - len < line_max)
+                {
+                    flush(block, len);
+                }
+                const CanFrame &frame = ring.peek(i);
+                len += format_candump_line(frame, wall_offset_ns, ifaces[frame.channel].c_str(), &block[len]);
+            }
+            ring.consume(count);
+            if (write_failed)
+            {
+                len = 0;
+            }
+            else
+            {
+                written += count;
+            }
+
+            // Report drops at most once per second
+            uint64_t drops = dropped.load(std::memory_order_relaxed);
+            uint64_t now = monotonic_ns();
+            if (drops != reported_drops && now - last_report >= 1000000000ull)
+            {
+                notices->post("[LOG] " + std::to_string(drops - reported_drops) +
+                              " frames dropped, writer cannot keep up");
+                reported_drops = drops;
+                last_report = now;
+            }
+
+            if (count == 0)
+            {
+                // Idle: write out what is buffered and wait for more frames
+                flush(block, len);
+                if (stopping)
+                    break;
+                usleep(DRAIN_INTERVAL_US);
+            }
+        }
+    }
+
+public:
+    CaptureLog()
+        : ring(RING_SIZE), line_max(0), file_fd(-1), wall_offset_ns(0), active(false), dropped(0), written(0),
+          write_failed(false), notices(nullptr)
+    {
+    }
+
+    ~CaptureLog()
+    {
+        close();
+    }
+
+    bool open(const std::string &file, const std::vector<std::string> &iface_names, NoticeQueue &notice_queue)
+    {
+        path = file;
+        ifaces = iface_names;
+        notices = &notice_queue;
+        line_max = candump_line_max(ifaces);
+        file_fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (file_fd < 0)
+        {
+            perror(file.c_str());
+            return false;
+        }
+
+        struct timespec real;
+        clock_gettime(CLOCK_REALTIME, &real);
+        wall_offset_ns = (int64_t)((uint64_t)real.tv_sec * 1000000000ull + real.tv_nsec) - (int64_t)monotonic_ns();
+
+        active = true;
+        writer = std::thread(&CaptureLog::writer_thread_func, this);
+        return true;
+    }
+
+    // Called from the RX thread, never blocks
+    void push(const CanFrame &frame)
+    {
+        if (!ring.push(frame))
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void close()
+    {
+        if (file_fd < 0)
+        {
+            return;
+        }
+
+        active = false;
+        writer.join();
+        ::close(file_fd);
+        file_fd = -1;
+
+        std::cout << "Capture log: " << written << " frames written to " << path;
+        if (dropped > 0)
+        {
+            std::cout << ", " << dropped << " frames dropped";
+        }
+        std::cout << std::endl;
+    }
+};
+
+// --trigger: keeps the last received frames in a ring and writes them to a
+// candump file when a condition fires, together with the frames received
+// after it. Conditions are "<id>[:<mask>][#<data>[/<mask>]]" for frames and
+// the keywords passive (error report with bus passive or bus off) and busoff
+// (#8 feedback). The RX thread only copies frames into the preallocated
+// ring; a finished capture is copied out once and written by a separate
+// thread. The trigger rearms when the capture is complete, captures that
+// complete while the previous one is still being written are counted as
+// missed.
+class TriggerCapture
+{
+private:
+    struct FrameCondition
+    {
+        bool extended;
+        uint32_t id;
+        uint32_t id_mask;
+        uint8_t len; // Data bytes compared, the frame needs at least this many
+        uint8_t data[64];
+        uint8_t data_mask[64];
+    };
+
+    std::vector<FrameCondition> frame_conditions;
+    bool on_passive;
+    bool on_bus_off;
+
+    // RX thread
+    std::vector<CanFrame> ring; // Power of two, more than pre + post frames
+    size_t mask;
+    size_t pre;
+    size_t post;
+    uint64_t next_seq; // Frames pushed so far
+    bool collecting;
+    uint64_t first_seq;   // First frame of the running capture
+    uint64_t trigger_seq; // First frame not before the trigger
+    uint64_t end_seq;     // The capture is complete when next_seq gets here
+    std::string reason;
+    uint64_t missed;
+
+    // Handed to the writer while dump_busy is set
+    std::vector<CanFrame> dump;
+    size_t dump_before;
+    std::string dump_reason;
+    std::atomic<bool> dump_busy;
+
+    std::string prefix;
+    std::vector<std::string> ifaces; // Interface name of each channel
+    int64_t wall_offset_ns;
+    int wake_fd;
+    std::atomic<bool> active;
+    unsigned files;
+    NoticeQueue *notices; // Reports of the writer go to the console through it
+    std::thread writer;
+
+    static bool parse_hex(const std::string &text, uint8_t *out, uint8_t &len)
+    {
+        if (text.empty() || text.size() % 2 != 0 || text.size() > 128 ||
+            !decode_hex_bytes(text.data(), out, text.size() / 2))
+        {
+            return false;
+        }
+        len = (uint8_t)(text.size() / 2);
+        return true;
+    }
+
+    static bool parse_id(const std::string &text, bool &extended, uint32_t &id)
+    {
+        if (text.empty() || text.size() > 8 || text.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+        {
+            return false;
+        }
+        extended = text.size() > 3;
+        id = (uint32_t)strtoul(text.c_str(), nullptr, 16);
+        return id <= (extended ? 0x1FFFFFFFu : 0x7FFu);
+    }
+
+    bool matches(const CanFrame &frame) const
+    {
+        for (size_t i = 0; i < frame_conditions.size(); i++)
+        {
+            const FrameCondition &c = frame_conditions[i];
+            if (((frame.flags & CAN_FLAG_EXT) != 0) != c.extended || (frame.id & c.id_mask) != c.id ||
+                frame.len < c.len)
+            {
+                continue;
+            }
+            uint8_t diff = 0;
+            for (size_t b = 0; b < c.len; b++)
+            {
+                diff |= (frame.data[b] & c.data_mask[b]) ^ c.data[b];
+            }
+            if (diff == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void fire(const SlcanRecord &msg, uint64_t seq)
+    {
+        collecting = true;
+        trigger_seq = seq;
+        first_seq = seq > pre ? seq - pre : 0;
+        end_seq = next_seq + post;
+        reason.assign(msg.data, msg.len);
+        reason += get_record_description(msg);
+    }
+
+    // Copies the capture out of the ring for the writer
+    void complete()
+    {
+        collecting = false;
+        if (dump_busy.load(std::memory_order_acquire))
+        {
+            missed++;
+            return;
+        }
+        dump.clear();
+        uint64_t last = std::min(end_seq, next_seq);
+        for (uint64_t seq = first_seq; seq < last; seq++)
+        {
+            dump.push_back(ring[seq & mask]);
+        }
+        dump_before = trigger_seq - first_seq;
+        dump_reason.swap(reason);
+        dump_busy.store(true, std::memory_order_release);
+        signal_eventfd(wake_fd);
     }
 
-    void restore_serial()
-    {
-        if (fd >= 0)
+    void write_dump()
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "-%u.log", ++files);
+        std::string path = prefix + name;
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            notices->post("[ERR] Trigger capture " + path + ": " + strerror(errno));
+            return;
+        }
+
+        std::vector<char> block(dump.size() * candump_line_max(ifaces) + 1);
+        size_t len = 0;
+        for (size_t i = 0; i < dump.size(); i++)
+        {
+            len += format_candump_line(dump[i], wall_offset_ns, ifaces[dump[i].channel].c_str(), &block[len]);
+        }
+        bool ok = write_all(fd, block.data(), len);
+        int error = errno;
+        ::close(fd);
+        if (!ok)
+        {
+            notices->post("[ERR] Trigger capture " + path + ": " + strerror(error));
+            return;
+        }
+        notices->post("[TRIG] " + dump_reason + ": " + std::to_string(dump.size()) + " frames written to " + path +
+                      ", " + std::to_string(dump_before) + " before the trigger");
+    }
+
+    void writer_thread_func()
+    {
+        for (;;)
+        {
+            if (dump_busy.load(std::memory_order_acquire))
+            {
+                write_dump();
+                dump_busy.store(false, std::memory_order_release);
+            }
+            if (!active)
+            {
+                break;
+            }
+            struct pollfd pfd;
+            pfd.fd = wake_fd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            if (poll(&pfd, 1, -1) > 0)
+            {
+                uint64_t value;
+                ssize_t r = read(wake_fd, &value, sizeof(value));
+                (void)r;
+            }
+        }
+    }
+
+public:
+    static const size_t DEFAULT_PRE = 1000;
+    static const size_t DEFAULT_POST = 1000;
+
+    TriggerCapture()
+        : on_passive(false), on_bus_off(false), mask(0), pre(DEFAULT_PRE), post(DEFAULT_POST), next_seq(0),
+          collecting(false), first_seq(0), trigger_seq(0), end_seq(0), missed(0), dump_before(0), dump_busy(false),
+          wall_offset_ns(0), wake_fd(-1), active(false), files(0), notices(nullptr)
+    {
+    }
+
+    ~TriggerCapture()
+    {
+        close();
+    }
+
+    // Adds the comma separated conditions of one --trigger option
+    bool add_conditions(const std::string &text)
+    {
+        std::stringstream ss(text);
+        std::string term;
+        while (std::getline(ss, term, ','))
+        {
+            if (strcasecmp(term.c_str(), "passive") == 0)
+            {
+                on_passive = true;
+                continue;
+            }
+            if (strcasecmp(term.c_str(), "busoff") == 0)
+            {
+                on_bus_off = true;
+                continue;
+            }
+
+            FrameCondition c;
+            memset(&c, 0, sizeof(c));
+            std::string id_text = term.substr(0, term.find('#'));
+            std::string data_text = term.size() > id_text.size() ? term.substr(id_text.size() + 1) : "";
+            size_t colon = id_text.find(':');
+            bool ok = parse_id(id_text.substr(0, colon), c.extended, c.id);
+            c.id_mask = c.extended ? 0x1FFFFFFFu : 0x7FFu;
+            if (ok && colon != std::string::npos)
+            {
+                bool mask_extended;
+                ok = parse_id(id_text.substr(colon + 1), mask_extended, c.id_mask);
+                c.id_mask &= c.extended ? 0x1FFFFFFFu : 0x7FFu;
+            }
+            c.id &= c.id_mask;
+            if (ok && term.size() > id_text.size())
+            {
+                size_t slash = data_text.find('/');
+                ok = parse_hex(data_text.substr(0, slash), c.data, c.len);
+                memset(c.data_mask, 0xFF, c.len);
+                if (ok && slash != std::string::npos)
+                {
+                    uint8_t mask_len;
+                    ok = parse_hex(data_text.substr(slash + 1), c.data_mask, mask_len) && mask_len == c.len;
+                }
+                for (size_t b = 0; b < c.len; b++)
+                {
+                    c.data[b] &= c.data_mask[b];
+                }
+            }
+            if (!ok)
+            {
+                std::cerr << "Error: Invalid trigger condition: " << term << std::endl;
+                return false;
+            }
+            frame_conditions.push_back(c);
+        }
+        return true;
+    }
+
+    // Captures go to <file_prefix>-1.log, -2.log, ...
+    bool open(const std::string &file_prefix, const std::vector<std::string> &iface_names, size_t pre_frames,
+              size_t post_frames, NoticeQueue &notice_queue)
+    {
+        prefix = file_prefix;
+        ifaces = iface_names;
+        notices = &notice_queue;
+        pre = pre_frames;
+        post = post_frames;
+        size_t size = 1;
+        while (size <= pre + post)
+        {
+            size *= 2;
+        }
+        ring.resize(size);
+        mask = size - 1;
+        dump.reserve(pre + post + 1);
+
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wake_fd < 0)
+        {
+            perror("eventfd");
+            return false;
+        }
+
+        struct timespec real;
+        clock_gettime(CLOCK_REALTIME, &real);
+        wall_offset_ns = (int64_t)((uint64_t)real.tv_sec * 1000000000ull + real.tv_nsec) - (int64_t)monotonic_ns();
+
+        active = true;
+        writer = std::thread(&TriggerCapture::writer_thread_func, this);
+        return true;
+    }
+
+    // Called from the RX thread for every frame. Returns true if the frame
+    // fired the trigger.
+    bool push(const CanFrame &frame, const SlcanRecord &msg)
+    {
+        uint64_t seq = next_seq++;
+        ring[seq & mask] = frame;
+
+        bool fired = false;
+        if (!collecting && matches(frame))
+        {
+            fire(msg, seq);
+            fired = true;
+        }
+        if (collecting && next_seq >= end_seq)
+        {
+            complete();
+        }
+        return fired;
+    }
+
+    // Called from the RX thread for records that are not frames. Returns
+    // true if the record fired the trigger.
+    bool check_record(const SlcanRecord &msg)
+    {
+        bool match = false;
+        if (on_passive && msg.len >= 9 && msg.data[0] == 'E')
+        {
+            uint8_t raw[4];
+            match = decode_hex_bytes(msg.data + 1, raw, 4) && (msg.data[1] == '2' || msg.data[1] == '3');
+        }
+        else if (on_bus_off && msg.len == 2 && msg.data[0] == '#' && msg.data[1] == '8')
+        {
+            match = true;
+        }
+        if (collecting || !match)
+        {
+            return false;
+        }
+        fire(msg, next_seq);
+        if (next_seq >= end_seq)
+        {
+            complete();
+        }
+        return true;
+    }
+
+    size_t frames_after() const
+    {
+        return post;
+    }
+
+    void close()
+    {
+        if (wake_fd < 0)
+        {
+            return;
+        }
+
+        // A capture cut short by the end of the session is written as far as it got
+        if (collecting)
+        {
+            complete();
+        }
+        active = false;
+        signal_eventfd(wake_fd);
+        writer.join();
+        ::close(wake_fd);
+        wake_fd = -1;
+
+        std::cout << "Trigger: " << files << " captures written";
+        if (missed > 0)
+        {
+            std::cout << ", " << missed << " missed while writing";
+        }
+        std::cout << std::endl;
+    }
+};
+
+// One received record waiting to be shown on the console
+struct DisplayItem
+{
+    enum Kind
+    {
+        RECORD,  // Shown as [RX]
+        TRIGGER, // The record fired --trigger
+        GAP,     // --reconnect: the adapter went away, text is the error
+    };
+
+    uint64_t timestamp_ns;
+    uint8_t channel;
+    uint8_t kind;
+    uint8_t len;
+    char text[253];
+};
+
+// Parses a script delay "<number>[us|ms|s]", default unit is ms
+static bool parse_delay(const char *s, size_t len, uint64_t &ns)
+{
+    std::string text(s, len);
+    char *end;
+    double value = strtod(text.c_str(), &end);
+    if (end == text.c_str() || value < 0)
+    {
+        return false;
+    }
+
+    std::string unit(end);
+    double scale;
+    if (unit.empty() || unit == "ms")
+        scale = 1e6;
+    else if (unit == "us")
+        scale = 1e3;
+    else if (unit == "s")
+        scale = 1e9;
+    else
+        return false;
+
+    ns = (uint64_t)(value * scale);
+    return true;
+}
+
+// Log-linear latency histogram in the style of HdrHistogram: every power of
+// two range is split into 32 linear sub-buckets, which keeps the relative
+// error below 3% over the whole 64 bit range with a fixed 15 KiB table.
+// One thread records, any thread may read a (slightly racy) snapshot.
+class LatencyHistogram
+{
+private:
+    static const int SUB_BITS = 5;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+    std::atomic<uint64_t> counts[BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> min_value;
+    std::atomic<uint64_t> max_value;
+
+    static int index_of(uint64_t value)
+    {
+        if (value < (uint64_t)SUB_COUNT)
+        {
+            return (int)value;
+        }
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - SUB_BITS;
+        return (shift + 1) * SUB_COUNT + (int)((value >> shift) - SUB_COUNT);
+    }
+
+    // Highest value that falls into bucket i
+    static uint64_t value_of(int i)
+    {
+        if (i < SUB_COUNT)
+        {
+            return (uint64_t)i;
+        }
+        int shift = i / SUB_COUNT - 1;
+        uint64_t lowest = (uint64_t)(SUB_COUNT + i % SUB_COUNT) << shift;
+        return lowest + ((uint64_t)1 << shift) - 1;
+    }
+
+public:
+    LatencyHistogram()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            counts[i].store(0, std::memory_order_relaxed);
+        }
+        total.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        min_value.store(UINT64_MAX, std::memory_order_relaxed);
+        max_value.store(0, std::memory_order_relaxed);
+    }
+
+    // Single writer: plain load/store instead of read-modify-write
+    void record(uint64_t value)
+    {
+        std::atomic<uint64_t> &bucket = counts[index_of(value)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        total.store(total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sum.store(sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        if (value < min_value.load(std::memory_order_relaxed))
+            min_value.store(value, std::memory_order_relaxed);
+        if (value > max_value.load(std::memory_order_relaxed))
+            max_value.store(value, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const
+    {
+        return total.load(std::memory_order_relaxed);
+    }
+
+    uint64_t min() const
+    {
+        return count() ? min_value.load(std::memory_order_relaxed) : 0;
+    }
+
+    uint64_t max() const
+    {
+        return max_value.load(std::memory_order_relaxed);
+    }
+
+    double mean() const
+    {
+        uint64_t n = count();
+        return n ? (double)sum.load(std::memory_order_relaxed) / n : 0.0;
+    }
+
+    // Upper bound of the bucket that holds the given percentile (0..100)
+    uint64_t percentile(double pct) const
+    {
+        uint64_t n = count();
+        if (n == 0)
+        {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(pct / 100.0 * n + 0.5);
+        rank = std::max<uint64_t>(rank, 1);
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+            {
+                return std::min(value_of(i), max());
+            }
+        }
+        return max();
+    }
+};
+
+
+// Hierarchical timer wheel for the cyclic transmit scheduler. Level n has
+// 64 slots of 64^n ticks each. A timer sits in the lowest level whose
+// current span contains its expiry and moves down a level when the wheel
+// reaches its slot, so scheduling and expiry are O(1) no matter how many
+// timers run. Timers are small integer handles chosen by the caller and are
+// linked through per-handle arrays, nothing is allocated while running.
+class TimerWheel
+{
+private:
+    static const unsigned LEVELS = 4;
+    static const unsigned SLOT_BITS = 6;
+    static const unsigned SLOTS = 1u << SLOT_BITS;
+    enum
+    {
+        NONE = -1
+    };
+
+    uint64_t now; // Current tick
+    int head[LEVELS][SLOTS];
+    std::vector<int> next;
+    std::vector<int> prev;
+    std::vector<int> slot_of; // level * SLOTS + slot, or NONE
+    std::vector<uint64_t> expiry;
+
+    void link(int handle)
+    {
+        uint64_t tick = expiry[handle];
+        unsigned level = 0;
+        while (level < LEVELS - 1 && (tick >> (SLOT_BITS * (level + 1))) != (now >> (SLOT_BITS * (level + 1))))
+        {
+            level++;
+        }
+        unsigned slot = (unsigned)(tick >> (SLOT_BITS * level)) & (SLOTS - 1);
+
+        int &first = head[level][slot];
+        next[handle] = first;
+        prev[handle] = NONE;
+        if (first != NONE)
+        {
+            prev[first] = handle;
+        }
+        first = handle;
+        slot_of[handle] = (int)(level * SLOTS + slot);
+    }
+
+    void unlink(int handle)
+    {
+        int &first = head[slot_of[handle] / SLOTS][slot_of[handle] % SLOTS];
+        if (prev[handle] != NONE)
+            next[prev[handle]] = next[handle];
+        else
+            first = next[handle];
+        if (next[handle] != NONE)
+            prev[next[handle]] = prev[handle];
+        slot_of[handle] = NONE;
+    }
+
+public:
+    TimerWheel() : now(0)
+    {
+        for (unsigned l = 0; l < LEVELS; l++)
+        {
+            for (unsigned s = 0; s < SLOTS; s++)
+            {
+                head[l][s] = NONE;
+            }
+        }
+    }
+
+    uint64_t current() const
+    {
+        return now;
+    }
+
+    // Expires the handle at the given tick, at the next tick if that has
+    // passed already. Must be less than 64^4 ticks ahead.
+    void schedule(int handle, uint64_t tick)
+    {
+        if ((size_t)handle >= slot_of.size())
+        {
+            next.resize(handle + 1, NONE);
+            prev.resize(handle + 1, NONE);
+            slot_of.resize(handle + 1, NONE);
+            expiry.resize(handle + 1, 0);
+        }
+        cancel(handle);
+        expiry[handle] = tick > now ? tick : now + 1;
+        link(handle);
+    }
+
+    void cancel(int handle)
+    {
+        if ((size_t)handle < slot_of.size() && slot_of[handle] != NONE)
+        {
+            unlink(handle);
+        }
+    }
+
+    bool scheduled(int handle) const
+    {
+        return (size_t)handle < slot_of.size() && slot_of[handle] != NONE;
+    }
+
+    // Advances by one tick and appends the handles expiring at it to due
+    void advance(std::vector<int> &due)
+    {
+        now++;
+
+        // Move the timers of the slots that start now down, higher levels first
+        for (unsigned level = LEVELS - 1; level > 0; level--)
+        {
+            if (now & (((uint64_t)1 << (SLOT_BITS * level)) - 1))
+                continue;
+            unsigned slot = (unsigned)(now >> (SLOT_BITS * level)) & (SLOTS - 1);
+            int handle = head[level][slot];
+            head[level][slot] = NONE;
+            while (handle != NONE)
+            {
+                int following = next[handle];
+                link(handle);
+                handle = following;
+            }
+        }
+
+        unsigned slot = (unsigned)now & (SLOTS - 1);
+        int handle = head[0][slot];
+        head[0][slot] = NONE;
+        while (handle != NONE)
+        {
+            due.push_back(handle);
+            slot_of[handle] = NONE;
+            handle = next[handle];
+        }
+    }
+};
+
+// CPU time consumed by a thread so far in seconds, or -1
+static double thread_cpu_seconds(pthread_t thread)
+{
+    clockid_t clock;
+    struct timespec ts;
+    if (pthread_getcpuclockid(thread, &clock) != 0 || clock_gettime(clock, &ts) != 0)
+    {
+        return -1;
+    }
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Host-side acceptance filter for --filter. Terms select IDs (123, 100-1FF,
+// 7E0:7F0 as ID:mask, 18DAF100-18DAF1FF) or frame types (std, ext, rtr, data,
+// classic, fd, brs), a leading ! excludes. A frame passes when it matches one
+// of the included ID terms (if any), one of the included types (if any) and
+// none of the excluded terms. IDs with more than 3 hex digits are extended.
+// compile() turns the terms into a bitmap of the 2048 standard IDs, sorted
+// merged ranges plus mask terms for extended IDs, and a table over the type
+// flags, so pass() costs a few loads for standard frames. Extended decisions
+// are cached in a small direct-mapped table. Used by the RX thread only.
+class FrameFilter
+{
+private:
+    static const uint32_t STD_IDS = 2048;
+    static const unsigned CACHE_BITS = 12;
+    static const uint32_t CACHE_VALID = 0x80000000; // Above the 29 ID bits
+    static const uint32_t CACHE_PASS = 0x40000000;
+    static const unsigned TYPE_BITS = CAN_FLAG_EXT | CAN_FLAG_RTR | CAN_FLAG_FDF | CAN_FLAG_BRS;
+
+    struct IdTerm
+    {
+        bool extended;
+        bool exclude;
+        uint32_t first; // Range first..last, or value with mask != 0
+        uint32_t last;
+        uint32_t mask;
+    };
+
+    struct Range
+    {
+        uint32_t first;
+        uint32_t last;
+
+        bool operator<(const Range &other) const
+        {
+            return first < other.first;
+        }
+    };
+
+    // Compiled form of the terms for one ID width
+    struct IdSet
+    {
+        std::vector<Range> ranges; // Sorted, not overlapping
+        std::vector<IdTerm> masks;
+
+        bool contains(uint32_t id) const
+        {
+            std::vector<Range>::const_iterator it =
+                std::upper_bound(ranges.begin(), ranges.end(), Range{id, id});
+            if (it != ranges.begin() && id <= (it - 1)->last)
+            {
+                return true;
+            }
+            for (size_t i = 0; i < masks.size(); i++)
+            {
+                if ((id & masks[i].mask) == masks[i].first)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    std::vector<IdTerm> terms;
+    uint16_t include_types; // Bit n = type flags n selected, 0 = no type terms
+    uint16_t exclude_types;
+
+    uint64_t std_bitmap[STD_IDS / 64];
+    uint16_t type_pass; // Bit n = frames with type flags n pass
+    bool any_include;   // Included ID terms exist of either width
+    IdSet std_include, std_exclude, ext_include, ext_exclude;
+    std::vector<uint32_t> ext_cache;
+
+    static bool parse_id(const std::string &text, bool &extended, uint32_t &id)
+    {
+        if (text.empty() || text.size() > 8)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < text.size(); i++)
+        {
+            if (!std::isxdigit((unsigned char)text[i]))
+            {
+                return false;
+            }
+        }
+        extended = text.size() > 3;
+        id = (uint32_t)strtoul(text.c_str(), nullptr, 16);
+        return id <= (extended ? 0x1FFFFFFFu : 0x7FFu);
+    }
+
+    // Frame type flags (EXT, RTR, FDF, BRS) selected by a type keyword
+    static bool parse_type(const std::string &text, uint16_t &types)
+    {
+        static const struct
+        {
+            const char *name;
+            unsigned flag;
+            bool set;
+        } keywords[] = {
+            {"std", CAN_FLAG_EXT, false}, {"ext", CAN_FLAG_EXT, true},
+            {"data", CAN_FLAG_RTR, false}, {"rtr", CAN_FLAG_RTR, true},
+            {"classic", CAN_FLAG_FDF, false}, {"fd", CAN_FLAG_FDF, true},
+            {"brs", CAN_FLAG_BRS, true},
+        };
+        for (size_t k = 0; k < sizeof(keywords) / sizeof(keywords[0]); k++)
+        {
+            if (strcasecmp(text.c_str(), keywords[k].name) == 0)
+            {
+                types = 0;
+                for (unsigned flags = 0; flags <= TYPE_BITS; flags++)
+                {
+                    if (((flags & keywords[k].flag) != 0) == keywords[k].set)
+                    {
+                        types |= (uint16_t)(1u << flags);
+                    }
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool add_term(std::string text)
+    {
+        bool exclude = !text.empty() && text[0] == '!';
+        if (exclude)
+        {
+            text.erase(0, 1);
+        }
+
+        uint16_t types;
+        if (parse_type(text, types))
+        {
+            (exclude ? exclude_types : include_types) |= types;
+            return true;
+        }
+
+        IdTerm term;
+        term.exclude = exclude;
+        term.mask = 0;
+        size_t sep = text.find_first_of(":-");
+        bool ok;
+        if (sep == std::string::npos)
+        {
+            ok = parse_id(text, term.extended, term.first);
+            term.last = term.first;
+        }
+        else
+        {
+            bool second_extended;
+            uint32_t second;
+            ok = parse_id(text.substr(0, sep), term.extended, term.first) &&
+                 parse_id(text.substr(sep + 1), second_extended, second);
+            if (ok && (second_extended || term.extended))
+            {
+                // 7FF-1000 or 123:1FFFFFFF make the whole term extended
+                term.extended = true;
+            }
+            if (text[sep] == ':')
+            {
+                term.mask = second;
+                term.first &= second;
+                term.last = term.first;
+                ok = ok && second != 0;
+            }
+            else
+            {
+                term.last = second;
+                ok = ok && term.first <= term.last;
+            }
+        }
+        if (!ok)
+        {
+            std::cerr << "Error: Invalid filter term '" << (exclude ? "!" : "") << text << "'" << std::endl;
+            return false;
+        }
+        terms.push_back(term);
+        return true;
+    }
+
+    void compile_set(IdSet &set, bool extended, bool exclude)
+    {
+        set.ranges.clear();
+        set.masks.clear();
+        for (size_t i = 0; i < terms.size(); i++)
+        {
+            const IdTerm &t = terms[i];
+            if (t.extended != extended || t.exclude != exclude)
+                continue;
+            if (t.mask)
+            {
+                set.masks.push_back(t);
+            }
+            else
+            {
+                set.ranges.push_back(Range{t.first, t.last});
+            }
+        }
+
+        // Merge overlapping and adjacent ranges so a lookup is one binary search
+        std::sort(set.ranges.begin(), set.ranges.end());
+        size_t out = 0;
+        for (size_t i = 0; i < set.ranges.size(); i++)
+        {
+            if (out > 0 && set.ranges[i].first <= set.ranges[out - 1].last + 1)
+            {
+                set.ranges[out - 1].last = std::max(set.ranges[out - 1].last, set.ranges[i].last);
+            }
+            else
+            {
+                set.ranges[out++] = set.ranges[i];
+            }
+        }
+        set.ranges.resize(out);
+    }
+
+    bool match_id(uint32_t id, const IdSet &include, const IdSet &exclude) const
+    {
+        return (any_include ? include.contains(id) : true) && !exclude.contains(id);
+    }
+
+public:
+    FrameFilter() : include_types(0), exclude_types(0), type_pass(0xFFFF), any_include(false)
+    {
+        memset(std_bitmap, 0xFF, sizeof(std_bitmap));
+    }
+
+    // Adds the comma separated terms of one --filter option
+    bool add(const std::string &expr)
+    {
+        std::stringstream ss(expr);
+        std::string text;
+        bool any = false;
+        while (std::getline(ss, text, ','))
+        {
+            if (text.empty())
+                continue;
+            if (!add_term(text))
+            {
+                return false;
+            }
+            any = true;
+        }
+        if (!any)
+        {
+            std::cerr << "Error: Empty filter expression" << std::endl;
+        }
+        return any;
+    }
+
+    void compile()
+    {
+        any_include = false;
+        for (size_t i = 0; i < terms.size(); i++)
+        {
+            any_include = any_include || !terms[i].exclude;
+        }
+        compile_set(std_include, false, false);
+        compile_set(std_exclude, false, true);
+        compile_set(ext_include, true, false);
+        compile_set(ext_exclude, true, true);
+
+        memset(std_bitmap, 0, sizeof(std_bitmap));
+        for (uint32_t id = 0; id < STD_IDS; id++)
+        {
+            if (match_id(id, std_include, std_exclude))
+            {
+                std_bitmap[id / 64] |= (uint64_t)1 << (id % 64);
+            }
+        }
+
+        type_pass = (include_types ? include_types : 0xFFFF) & (uint16_t)~exclude_types;
+        ext_cache.assign((size_t)1 << CACHE_BITS, 0);
+    }
+
+    bool pass(const CanFrame &frame)
+    {
+        if (!((type_pass >> (frame.flags & TYPE_BITS)) & 1))
+        {
+            return false;
+        }
+        if (!(frame.flags & CAN_FLAG_EXT))
+        {
+            if (frame.id < STD_IDS)
+            {
+                return (std_bitmap[frame.id / 64] >> (frame.id % 64)) & 1;
+            }
+            // A 3 digit ID above 0x7FF is invalid, it can only match exclusions
+            return !any_include && !std_exclude.contains(frame.id);
+        }
+
+        uint32_t &slot = ext_cache[(frame.id * 0x9E3779B1u) >> (32 - CACHE_BITS)];
+        if ((slot & ~CACHE_PASS) == (frame.id | CACHE_VALID))
+        {
+            return (slot & CACHE_PASS) != 0;
+        }
+        bool result = match_id(frame.id, ext_include, ext_exclude);
+        slot = frame.id | CACHE_VALID | (result ? CACHE_PASS : 0);
+        return result;
+    }
+};
+
+// Signal decoder for --dbc. The DBC file is parsed once into a decode plan
+// per message: for every signal the bytes it spans, the shift and mask that
+// extract its raw value, sign, scaling and the multiplexor value it belongs
+// to. Plans are found through a table for 11 bit IDs and a hash map for 29
+// bit IDs, so decoding a frame is a lookup plus a few shifts per signal.
+// Supports BO_, SG_ (Intel and Motorola byte order, simple multiplexing),
+// VAL_ descriptions and SIG_VALTYPE_ float and double signals.
+class DbcDecoder
+{
+private:
+    struct Signal
+    {
+        std::string name;
+        std::string label;  // "Name="
+        std::string unit;   // " rpm", or empty
+        uint8_t first_byte;
+        uint8_t byte_count; // 1..9
+        uint8_t shift;      // Intel: bits below the signal, Motorola: bits after it
+        bool big_endian;    // Motorola
+        bool is_signed;
+        uint8_t value_type; // 0 = integer, 1 = float, 2 = double
+        uint64_t mask;
+        uint64_t sign_bit;
+        double factor;
+        double offset;
+        bool integral;      // factor 1, offset 0: shown without conversion
+        int mux_value;      // -1 = present in every frame
+        std::vector<std::pair<int64_t, std::string> > descriptions; // Sorted by value
+    };
+
+    struct Message
+    {
+        uint32_t id;
+        bool extended;
+        std::string prefix; // "0C9 EngineData:"
+        int multiplexor;    // Index of the multiplexor signal, -1 = none
+        std::vector<Signal> signals;
+    };
+
+    std::vector<Message> messages;
+    std::vector<int> std_index; // 11 bit ID -> message, -1 = none
+    std::unordered_map<uint32_t, int> ext_index;
+    size_t signal_count;
+
+    static uint64_t extract(const Signal &s, const uint8_t *data)
+    {
+        const uint8_t *p = data + s.first_byte;
+        unsigned n = s.byte_count > 8 ? 8 : s.byte_count;
+        uint64_t v = 0;
+        if (!s.big_endian)
+        {
+            for (unsigned k = n; k-- > 0;)
+                v = (v << 8) | p[k];
+            v >>= s.shift;
+            if (s.byte_count > 8)
+                v |= (uint64_t)p[8] << (64 - s.shift);
+        }
+        else
+        {
+            for (unsigned k = 0; k < n; k++)
+                v = (v << 8) | p[k];
+            if (s.byte_count > 8)
+                v = (v << (8 - s.shift)) | (p[8] >> s.shift);
+            else
+                v >>= s.shift;
+        }
+        return v & s.mask;
+    }
+
+    static int64_t to_signed(const Signal &s, uint64_t raw)
+    {
+        return (s.is_signed && (raw & s.sign_bit)) ? (int64_t)(raw | ~s.mask) : (int64_t)raw;
+    }
+
+    Message *find_message(uint32_t id, bool extended)
+    {
+        for (size_t i = 0; i < messages.size(); i++)
+        {
+            if (messages[i].id == id && messages[i].extended == extended)
+                return &messages[i];
+        }
+        return nullptr;
+    }
+
+    Signal *find_signal(uint32_t dbc_id, const std::string &name)
+    {
+        Message *m = find_message(dbc_id & 0x1FFFFFFF, (dbc_id & 0x80000000) != 0);
+        for (size_t i = 0; m && i < m->signals.size(); i++)
+        {
+            if (m->signals[i].name == name)
+                return &m->signals[i];
+        }
+        return nullptr;
+    }
+
+    // " SG_ Name [M|m<n>] : start|length@order sign (factor,offset) [min|max] "unit" receivers"
+    bool parse_signal(const std::string &line, Message &m)
+    {
+        size_t colon = line.find(':');
+        if (colon == std::string::npos)
+            return false;
+        std::istringstream head(line.substr(0, colon));
+        std::string keyword, name, mux;
+        head >> keyword >> name >> mux;
+
+        Signal s;
+        unsigned start, length;
+        int order;
+        char sign;
+        if (name.empty() ||
+            sscanf(line.c_str() + colon + 1, " %u|%u@%1d%c (%lf,%lf)", &start, &length, &order, &sign, &s.factor,
+                   &s.offset) != 6 ||
+            length < 1 || length > 64 || (order != 0 && order != 1) || (sign != '+' && sign != '-'))
+        {
+            return false;
+        }
+        s.name = name;
+        s.label = name + "=";
+        size_t quote = line.find('"', colon);
+        size_t end = quote == std::string::npos ? quote : line.find('"', quote + 1);
+        if (end != std::string::npos && end > quote + 1)
+        {
+            s.unit = " " + line.substr(quote + 1, end - quote - 1);
+        }
+
+        s.big_endian = order == 0;
+        s.is_signed = sign == '-';
+        s.value_type = 0;
+        s.mask = length == 64 ? ~(uint64_t)0 : ((uint64_t)1 << length) - 1;
+        s.sign_bit = (uint64_t)1 << (length - 1);
+        s.integral = s.factor == 1 && s.offset == 0;
+        if (!s.big_endian)
+        {
+            s.first_byte = (uint8_t)(start / 8);
+            s.shift = (uint8_t)(start % 8);
+            s.byte_count = (uint8_t)((s.shift + length + 7) / 8);
+        }
+        else
+        {
+            // Motorola start bits number the MSB within its byte
+            unsigned msb = (start / 8) * 8 + (7 - start % 8);
+            unsigned lsb = msb + length - 1;
+            s.first_byte = (uint8_t)(msb / 8);
+            s.byte_count = (uint8_t)(lsb / 8 - msb / 8 + 1);
+            s.shift = (uint8_t)(7 - lsb % 8);
+        }
+        if (s.first_byte + s.byte_count > 64)
+            return false;
+
+        s.mux_value = -1;
+        if (mux == "M")
+        {
+            m.multiplexor = (int)m.signals.size();
+        }
+        else if (mux.size() > 1 && mux[0] == 'm')
+        {
+            s.mux_value = atoi(mux.c_str() + 1);
+        }
+        m.signals.push_back(s);
+        return true;
+    }
+
+    // VAL_ id Signal value "text" value "text" ... ;
+    void parse_descriptions(const std::string &line)
+    {
+        std::istringstream in(line);
+        std::string keyword, name;
+        uint32_t id;
+        if (!(in >> keyword >> id >> name))
+            return;
+        Signal *s = find_signal(id, name);
+        if (!s)
+            return;
+
+        size_t pos = (size_t)in.tellg();
+        for (;;)
+        {
+            size_t open = line.find('"', pos);
+            size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+            if (close == std::string::npos)
+                break;
+            long long value;
+            if (sscanf(line.c_str() + pos, "%lld", &value) != 1)
+                break;
+            s->descriptions.push_back(std::make_pair((int64_t)value, line.substr(open + 1, close - open - 1)));
+            pos = close + 1;
+        }
+        std::sort(s->descriptions.begin(), s->descriptions.end());
+    }
+
+    // SIG_VALTYPE_ id Signal : 1|2;
+    void parse_value_type(const std::string &line)
+    {
+        char name[256];
+        uint32_t id;
+        unsigned type;
+        if (sscanf(line.c_str(), "SIG_VALTYPE_ %u %255[^ :] : %u", &id, name, &type) != 3)
+            return;
+        Signal *s = find_signal(id, name);
+        if (s && ((type == 1 && s->mask == 0xFFFFFFFFu) || (type == 2 && s->mask == ~(uint64_t)0)))
+        {
+            s->value_type = (uint8_t)type;
+        }
+    }
+
+    void append_value(const Signal &s, uint64_t raw, std::string &out) const
+    {
+        char buf[64];
+        if (s.value_type == 1)
+        {
+            uint32_t bits = (uint32_t)raw;
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            snprintf(buf, sizeof(buf), "%.9g", f * s.factor + s.offset);
+        }
+        else if (s.value_type == 2)
+        {
+            double d;
+            memcpy(&d, &raw, sizeof(d));
+            snprintf(buf, sizeof(buf), "%.17g", d * s.factor + s.offset);
+        }
+        else if (s.integral)
+        {
+            if (s.is_signed)
+                snprintf(buf, sizeof(buf), "%lld", (long long)to_signed(s, raw));
+            else
+                snprintf(buf, sizeof(buf), "%llu", (unsigned long long)raw);
+        }
+        else
+        {
+            double value = s.is_signed ? (double)to_signed(s, raw) : (double)raw;
+            snprintf(buf, sizeof(buf), "%.10g", value * s.factor + s.offset);
+        }
+        out += buf;
+
+        if (!s.descriptions.empty())
+        {
+            int64_t key = to_signed(s, raw);
+            std::vector<std::pair<int64_t, std::string> >::const_iterator it = std::lower_bound(
+                s.descriptions.begin(), s.descriptions.end(), std::make_pair(key, std::string()));
+            if (it != s.descriptions.end() && it->first == key)
+            {
+                out += " (" + it->second + ")";
+            }
+        }
+        out += s.unit;
+    }
+
+public:
+    DbcDecoder() : std_index(2048, -1), signal_count(0) {}
+
+    bool load(const std::string &path)
+    {
+        std::ifstream in(path.c_str());
+        if (!in)
+        {
+            std::cerr << "Error: Cannot open DBC file: " << path << std::endl;
+            return false;
+        }
+
+        std::string line;
+        size_t line_no = 0;
+        Message *current = nullptr;
+        while (std::getline(in, line))
+        {
+            line_no++;
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            size_t first = line.find_first_not_of(" \t");
+            if (first == std::string::npos)
+            {
+                current = nullptr;
+                continue;
+            }
+
+            if (line.compare(first, 4, "BO_ ") == 0)
+            {
+                uint32_t dbc_id;
+                char name[256];
+                if (sscanf(line.c_str() + first, "BO_ %u %255[^: ]", &dbc_id, name) != 2)
+                {
+                    std::cerr << "Error: " << path << ":" << line_no << ": Invalid message" << std::endl;
+                    return false;
+                }
+                // Pseudo message of signals not sent by any node
+                if (dbc_id == 0xC0000000u)
+                {
+                    current = nullptr;
+                    continue;
+                }
+
+                Message m;
+                m.extended = (dbc_id & 0x80000000u) != 0;
+                m.id = dbc_id & 0x1FFFFFFF;
+                m.multiplexor = -1;
+                char id_text[16];
+                snprintf(id_text, sizeof(id_text), m.extended ? "%08X" : "%03X", m.id);
+                m.prefix = std::string(id_text) + " " + name + ":";
+                messages.push_back(m);
+                current = &messages.back();
+            }
+            else if (line.compare(first, 4, "SG_ ") == 0)
+            {
+                if (!current)
+                    continue;
+                if (!parse_signal(line, *current))
+                {
+                    std::cerr << "Error: " << path << ":" << line_no << ": Invalid signal" << std::endl;
+                    return false;
+                }
+            }
+            else if (line.compare(first, 5, "VAL_ ") == 0)
+            {
+                parse_descriptions(line);
+            }
+            else if (line.compare(first, 13, "SIG_VALTYPE_ ") == 0)
+            {
+                parse_value_type(line.substr(first));
+            }
+        }
+
+        for (size_t i = 0; i < messages.size(); i++)
+        {
+            signal_count += messages[i].signals.size();
+            if (!messages[i].extended && messages[i].id < std_index.size())
+                std_index[messages[i].id] = (int)i;
+            else
+                ext_index[messages[i].id | (messages[i].extended ? 0x80000000u : 0)] = (int)i;
+        }
+        return true;
+    }
+
+    size_t message_count() const
+    {
+        return messages.size();
+    }
+
+    size_t total_signals() const
+    {
+        return signal_count;
+    }
+
+    // Appends "<id> <Message>: Signal=value unit, ..." and returns true if
+    // the DBC describes the frame
+    bool format(const CanFrame &frame, std::string &out) const
+    {
+        int index;
+        if (frame.flags & CAN_FLAG_RTR)
+        {
+            return false;
+        }
+        if (!(frame.flags & CAN_FLAG_EXT) && frame.id < std_index.size())
+        {
+            index = std_index[frame.id];
+        }
+        else
+        {
+            std::unordered_map<uint32_t, int>::const_iterator it =
+                ext_index.find(frame.id | ((frame.flags & CAN_FLAG_EXT) ? 0x80000000u : 0));
+            index = it == ext_index.end() ? -1 : it->second;
+        }
+        if (index < 0)
+        {
+            return false;
+        }
+
+        const Message &m = messages[index];
+        out += m.prefix;
+        int64_t mux = -1;
+        if (m.multiplexor >= 0)
+        {
+            const Signal &s = m.signals[m.multiplexor];
+            if (s.first_byte + s.byte_count <= frame.len)
+                mux = (int64_t)extract(s, frame.data);
+        }
+
+        const char *separator = " ";
+        for (size_t i = 0; i < m.signals.size(); i++)
+        {
+            const Signal &s = m.signals[i];
+            if ((s.mux_value >= 0 && s.mux_value != mux) || s.first_byte + s.byte_count > frame.len)
+                continue;
+            out += separator;
+            out += s.label;
+            append_value(s, extract(s, frame.data), out);
+            separator = ", ";
+        }
+        return true;
+    }
+};
+
+// Receive statistics per CAN ID for the --stats dashboard. 11 bit IDs index
+// a flat table directly, 29 bit IDs live in an open-addressing hash table
+// with linear probing, so an update touches one contiguous entry. One table
+// per channel, updated by the RX thread, read by the display thread.
+// Both tables are allocated up front and every slot is guarded by a
+// sequence counter (odd while the RX thread writes it), so the RX thread
+// never waits for the reader: snapshot() retries a slot that changed while
+// it was copied. All reader state lives in separate arrays.
+class IdStatsTable
+{
+public:
+    struct Entry
+    {
+        uint32_t id;
+        bool used;
+        bool extended;
+        uint8_t channel;
+        uint8_t dlc;  // Of the last frame
+        uint8_t len;
+        uint64_t count;
+        uint64_t changes; // Frames with a payload different from the one before
+        uint64_t first_ns;
+        uint64_t last_ns;
+        uint64_t min_gap_ns;
+        uint64_t max_gap_ns;
+        uint64_t shown_count;   // count at the previous snapshot
+        uint64_t shown_changes; // changes at the previous snapshot
+        uint64_t changed_bytes; // Bit per data byte changed since the previous snapshot
+        uint8_t data[64];
+    };
+
+private:
+    static const size_t STD_IDS = 2048;
+    static const size_t EXT_SLOTS = 4096; // Power of two, at most half of them are used
+
+    struct Slot
+    {
+        std::atomic<uint32_t> seq;
+        Entry entry;              // Without the shown_* and changed_bytes fields
+        uint8_t byte_changes[64]; // Changes per data byte, wrapping
+
+        Slot() : seq(0)
+        {
+            memset(&entry, 0, sizeof(entry));
+            memset(byte_changes, 0, sizeof(byte_changes));
+        }
+    };
+
+    // Reader side state of a slot at the previous snapshot
+    struct Shown
+    {
+        uint64_t count;
+        uint64_t changes;
+        uint8_t byte_changes[64];
+    };
+
+    std::vector<Slot> std_table;
+    std::vector<Slot> ext_table;
+    size_t ext_used;
+    std::atomic<uint64_t> untracked; // Frames of IDs that did not fit into ext_table
+    std::vector<Shown> std_shown;
+    std::vector<Shown> ext_shown;
+
+    static size_t ext_slot(uint32_t id)
+    {
+        return (size_t)((id * 0x9E3779B1u) >> 7) & (EXT_SLOTS - 1);
+    }
+
+    Slot *find_ext(uint32_t id, bool extended)
+    {
+        size_t i = ext_slot(id);
+        while (ext_table[i].entry.used && (ext_table[i].entry.id != id || ext_table[i].entry.extended != extended))
+        {
+            i = (i + 1) & (EXT_SLOTS - 1);
+        }
+        // Keeps the load factor at or below 1/2 so probe sequences stay short
+        if (!ext_table[i].entry.used && (ext_used + 1) * 2 > EXT_SLOTS)
+        {
+            return nullptr;
+        }
+        return &ext_table[i];
+    }
+
+    // Copies a slot the RX thread may be writing
+    static void read_slot(const Slot &slot, Entry &entry, uint8_t *byte_changes)
+    {
+        for (;;)
+        {
+            uint32_t seq = slot.seq.load(std::memory_order_acquire);
+            if (seq & 1)
+            {
+                continue;
+            }
+            memcpy(&entry, &slot.entry, sizeof(entry));
+            memcpy(byte_changes, slot.byte_changes, sizeof(slot.byte_changes));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) == seq)
+            {
+                return;
+            }
+        }
+    }
+
+    static void append_used(const std::vector<Slot> &table, std::vector<Shown> &shown, std::vector<Entry> &out)
+    {
+        uint8_t byte_changes[64];
+        for (size_t i = 0; i < table.size(); i++)
+        {
+            if (!table[i].entry.used)
+            {
+                continue;
+            }
+            out.push_back(Entry());
+            Entry &e = out.back();
+            read_slot(table[i], e, byte_changes);
+            if (!e.used)
+            {
+                out.pop_back();
+                continue;
+            }
+
+            Shown &s = shown[i];
+            e.shown_count = s.count;
+            e.shown_changes = s.changes;
+            e.changed_bytes = 0;
+            for (size_t b = 0; b < e.len; b++)
+            {
+                if (byte_changes[b] != s.byte_changes[b])
+                {
+                    e.changed_bytes |= 1ull << b;
+                }
+            }
+            s.count = e.count;
+            s.changes = e.changes;
+            memcpy(s.byte_changes, byte_changes, sizeof(byte_changes));
+        }
+    }
+
+public:
+    IdStatsTable()
+        : std_table(STD_IDS), ext_table(EXT_SLOTS), ext_used(0), untracked(0), std_shown(STD_IDS), ext_shown(EXT_SLOTS)
+    {
+    }
+
+    void update(const CanFrame &frame)
+    {
+        // A 3 digit ID above 0x7FF is invalid but possible, keep it apart
+        bool extended = (frame.flags & CAN_FLAG_EXT) != 0;
+        bool in_ext = extended || frame.id >= STD_IDS;
+        Slot *slot = in_ext ? find_ext(frame.id, extended) : &std_table[frame.id];
+        if (!slot)
+        {
+            untracked.store(untracked.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+
+        uint32_t seq = slot->seq.load(std::memory_order_relaxed);
+        slot->seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        Entry *e = &slot->entry;
+        if (!e->used)
+        {
+            e->used = true;
+            e->id = frame.id;
+            e->extended = extended;
+            e->channel = frame.channel;
+            e->first_ns = frame.timestamp_ns;
+            e->min_gap_ns = UINT64_MAX;
+            if (in_ext)
+            {
+                ext_used++;
+            }
+        }
+        else
+        {
+            uint64_t gap = frame.timestamp_ns - e->last_ns;
+            e->min_gap_ns = std::min(e->min_gap_ns, gap);
+            e->max_gap_ns = std::max(e->max_gap_ns, gap);
+            if (frame.len != e->len || memcmp(frame.data, e->data, frame.len) != 0)
+            {
+                e->changes++;
+                for (size_t b = 0; b < frame.len; b++)
+                {
+                    if (b >= e->len || frame.data[b] != e->data[b])
+                    {
+                        slot->byte_changes[b]++;
+                    }
+                }
+            }
+        }
+
+        e->count++;
+        e->last_ns = frame.timestamp_ns;
+        e->dlc = frame.dlc;
+        e->len = frame.len;
+        memcpy(e->data, frame.data, frame.len);
+
+        slot->seq.store(seq + 2, std::memory_order_release);
+    }
+
+    // Copies all used entries, standard IDs first, both sorted by ID. The
+    // shown_* fields of the copies hold the values of the previous snapshot.
+    // Only one thread may take snapshots.
+    void snapshot(std::vector<Entry> &out)
+    {
+        out.clear();
+        append_used(std_table, std_shown, out);
+        size_t ext_first = out.size();
+        append_used(ext_table, ext_shown, out);
+        std::sort(out.begin() + ext_first, out.end(), [](const Entry &a, const Entry &b) {
+            return a.extended != b.extended ? !a.extended : a.id < b.id;
+        });
+    }
+
+    // Frames not counted because the table of 29 bit IDs was full
+    uint64_t untracked_frames() const
+    {
+        return untracked.load(std::memory_order_relaxed);
+    }
+};
+
+// Full-screen --sniff view: one row per ID with its latest payload, the
+// bytes that changed recently highlighted and IDs without frames for a while
+// hidden. The screen is kept as a grid of cells and every update emits only
+// the cells that differ from the previous one, so the console output depends
+// on the screen size and not on the frame rate.
+class SniffView
+{
+public:
+    static const uint64_t HIGHLIGHT_NS = 500000000; // Changed bytes stay highlighted this long
+    static const uint64_t STALE_NS = 3000000000ull; // IDs without frames for this long are hidden
+    static const uint64_t RATE_TAU_NS = 1000000000; // Time constant of the per-ID rate average
+
+private:
+    enum Attr
+    {
+        ATTR_NORMAL,
+        ATTR_CHANGED,
+        ATTR_HEADER,
+        ATTR_NONE, // Nothing on the screen yet, always differs
+    };
+
+    struct Cell
+    {
+        char ch;
+        uint8_t attr;
+
+        bool operator!=(const Cell &other) const
+        {
+            return ch != other.ch || attr != other.attr;
+        }
+    };
+
+    struct Row
+    {
+        uint64_t count; // Frames at the previous update
+        double rate;    // Frames/s, averaged
+        uint64_t changed_ns[64];
+    };
+
+    std::unordered_map<uint64_t, Row> rows; // Key: channel, IDE and ID
+    std::vector<Cell> screen;               // Being drawn
+    std::vector<Cell> shown;                // On the terminal
+    int width;
+    int height;
+    uint64_t last_ns;
+
+    void put(int row, int col, const char *text, size_t len, uint8_t attr)
+    {
+        if (row < 0 || row >= height)
+            return;
+        for (size_t i = 0; i < len && col < width; i++, col++)
+        {
+            Cell &c = screen[row * width + col];
+            c.ch = text[i];
+            c.attr = attr;
+        }
+    }
+
+    void put(int row, int col, const std::string &text, uint8_t attr = ATTR_NORMAL)
+    {
+        put(row, col, text.data(), text.size(), attr);
+    }
+
+    static void append_attr(std::string &out, uint8_t attr)
+    {
+        static const char *const sgr[] = {"\033[0m", "\033[1;31m", "\033[7m"};
+        out += sgr[attr];
+    }
+
+    // Emits the differences between screen and shown. Runs of changed cells
+    // less than a cursor move apart are joined.
+    void emit_diff(std::string &out)
+    {
+        static const int JOIN_GAP = 6;
+        uint8_t attr = ATTR_NONE;
+        char move[32];
+        for (int r = 0; r < height; r++)
+        {
+            const Cell *now = &screen[r * width];
+            const Cell *before = &shown[r * width];
+            int c = 0;
+            while (c < width)
+            {
+                if (!(now[c] != before[c]))
+                {
+                    c++;
+                    continue;
+                }
+                int end = c + 1;
+                for (int next = end; next < width && next - end < JOIN_GAP; next++)
+                {
+                    if (now[next] != before[next])
+                    {
+                        end = next + 1;
+                    }
+                }
+                out.append(move, snprintf(move, sizeof(move), "\033[%d;%dH", r + 1, c + 1));
+                for (; c < end; c++)
+                {
+                    if (now[c].attr != attr)
+                    {
+                        attr = now[c].attr;
+                        append_attr(out, attr);
+                    }
+                    out += now[c].ch;
+                }
+            }
+        }
+        if (attr != ATTR_NORMAL && attr != ATTR_NONE)
+        {
+            append_attr(out, ATTR_NORMAL);
+        }
+        shown = screen;
+    }
+
+public:
+    SniffView() : width(0), height(0), last_ns(0) {}
+
+    // Draws the entries of IdStatsTable::snapshot() (with the channel column
+    // if multi) below the header lines and above the footer lines, and
+    // leaves the cursor behind the prompt if there is one. cols x lines is
+    // the terminal size.
+    void render(const std::vector<IdStatsTable::Entry> &entries, bool multi, uint64_t now,
+                const std::vector<std::string> &header, const std::deque<std::string> &footer, bool show_prompt,
+                const std::string &prompt, int cols, int lines, std::string &out)
+    {
+        out.clear();
+
+        // The last column stays empty, so the terminal never wraps
+        if (cols - 1 != width || lines != height)
+        {
+            width = cols - 1;
+            height = lines;
+            Cell none = {' ', ATTR_NONE};
+            shown.assign(width * height, none);
+            out += "\033[H\033[2J";
+        }
+        Cell blank = {' ', ATTR_NORMAL};
+        screen.assign(width * height, blank);
+
+        double elapsed = last_ns ? (now - last_ns) / 1e9 : 0;
+        double weight = std::min(1.0, elapsed * 1e9 / RATE_TAU_NS);
+        last_ns = now;
+
+        // Rows of the table: below the header and the column titles, above
+        // an empty line, the footer and the prompt
+        int row = 0;
+        for (size_t i = 0; i < header.size(); i++)
+        {
+            put(row++, 0, header[i]);
+        }
+        row++; // Summary
+        std::string titles = multi ? "Ch " : "";
+        titles += "      ID   Frames/s Len  Data";
+        titles.resize(width, ' ');
+        put(row++, 0, titles, ATTR_HEADER);
+        int first_row = row;
+        int last_row = height - (int)footer.size() - (show_prompt ? 2 : 1);
+
+        size_t hidden = 0;
+        size_t skipped = 0;
+        double total_rate = 0;
+        char text[64];
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            const IdStatsTable::Entry &e = entries[i];
+            uint64_t key = ((uint64_t)e.channel << 33) | ((uint64_t)e.extended << 32) | e.id;
+            std::unordered_map<uint64_t, Row>::iterator it = rows.find(key);
+            if (it == rows.end())
+            {
+                Row fresh;
+                memset(&fresh, 0, sizeof(fresh));
+                fresh.count = e.shown_count;
+                fresh.rate = -1;
+                it = rows.insert(std::make_pair(key, fresh)).first;
+            }
+            Row &r = it->second;
+
+            if (elapsed > 0)
+            {
+                double instant = (e.count - r.count) / elapsed;
+                r.rate = (r.rate < 0) ? instant : r.rate + (instant - r.rate) * weight;
+            }
+            r.count = e.count;
+            for (uint64_t bits = e.changed_bytes; bits; bits &= bits - 1)
+            {
+                r.changed_ns[__builtin_ctzll(bits)] = now;
+            }
+            total_rate += r.rate > 0 ? r.rate : 0;
+
+            if (now - e.last_ns > STALE_NS)
+            {
+                hidden++;
+                continue;
+            }
+            if (row >= last_row)
+            {
+                skipped++;
+                continue;
+            }
+
+            int col = 0;
+            if (multi)
+            {
+                put(row, col, text, snprintf(text, sizeof(text), "%2u ", e.channel), ATTR_NORMAL);
+                col += 3;
+            }
+            int n = snprintf(text, sizeof(text), e.extended ? "%08X %10.1f %3u " : "     %03X %10.1f %3u ", e.id,
+                             r.rate > 0 ? r.rate : 0.0, e.len);
+            put(row, col, text, n, ATTR_NORMAL);
+            col += n;
+            for (size_t b = 0; b < e.len && col + 3 <= width; b++, col += 3)
+            {
+                char hex[3] = {' ', hex_upper[e.data[b] >> 4], hex_upper[e.data[b] & 0x0F]};
+                bool changed = r.changed_ns[b] && now - r.changed_ns[b] < HIGHLIGHT_NS;
+                put(row, col, hex, 1, ATTR_NORMAL);
+                put(row, col + 1, hex + 1, 2, changed ? ATTR_CHANGED : ATTR_NORMAL);
+            }
+            row++;
+        }
+        if (skipped > 0)
+        {
+            put(last_row, 0, "  ... " + std::to_string(skipped) + " more IDs");
+        }
+
+        // Summary line between the header and the column titles, now that
+        // the numbers are known
+        put(first_row - 2, 0, text,
+            snprintf(text, sizeof(text), "IDs: %zu   Stale: %zu   Frames/s: %.1f", entries.size() - hidden, hidden,
+                     total_rate),
+            ATTR_NORMAL);
+
+        row = last_row + 1;
+        for (size_t i = 0; i < footer.size(); i++)
+        {
+            put(row++, 0, footer[i]);
+        }
+        if (show_prompt)
+        {
+            put(row, 0, "> " + prompt);
+        }
+
+        emit_diff(out);
+        int cursor_col = show_prompt ? (int)std::min<size_t>(prompt.size() + 2, width) : 0;
+        out.append(text, snprintf(text, sizeof(text), "\033[%d;%dH", height, cursor_col + 1));
+    }
+};
+
+class SlcanTerminal
+{
+private:
+    static const size_t TX_QUEUE_SIZE = 4096;
+    static const size_t TX_BATCH_SIZE = 64 * 1024;
+    static const size_t DISPLAY_QUEUE_SIZE = 8192;
+    static const uint64_t DISPLAY_INTERVAL_NS = 20000000; // Max. 50 console updates per second
+
+    // Tx echo markers (MM mode): producers append a rolling marker to each
+    // frame, the TX thread stamps the send time and the RX thread matches
+    // the M<xx> echo against it
+    static const int MARKER_COUNT = 256;
+
+    // Adapter modes that change what it sends back, followed from the
+    // commands written to it
+    enum AdapterMode
+    {
+        MODE_FEEDBACK = 0x01, // MF: # or +text answer to every command
+        MODE_MARKERS = 0x02,  // MM: M<xx> echo for every sent frame
+    };
+
+    // Credit based send window. A frame takes a credit when it is written
+    // and returns it when its echo arrives (markers on) or its feedback
+    // arrives (feedback only). The TX thread stops at the first frame that
+    // finds the window full. #7/#8 halve the window, pause the TX thread
+    // and send the frame again, every window of acknowledged frames grows
+    // the window by one up to the configured size.
+    struct SentCommand
+    {
+        uint64_t sent_ns;
+        uint16_t len;
+        int16_t marker;
+        uint8_t flags;
+        uint8_t retries;
+        char data[TxQueue::SLOT_SIZE]; // Only kept for frames
+    };
+    static const size_t TX_PENDING_SIZE = 1024;
+
+    // Command of the TX thread's current batch, kept to take back its
+    // accounting when the write fails
+    struct TxBatchEntry
+    {
+        size_t end;     // Offset after the command in the batch
+        size_t pending; // Sequence number in tx_pending (TX_FLAG_FEEDBACK)
+        uint64_t sent_ns;
+        int16_t marker;
+        uint8_t flags;
+    };
+    static const unsigned TX_MAX_RETRIES = 16;
+    static const uint64_t TX_STALE_NS = 2000000000;       // No answer: give the credit back
+    static const uint64_t TX_BACKOFF_MIN_NS = 1000000;    // After #7, doubled while repeated
+    static const uint64_t TX_BACKOFF_MAX_NS = 100000000;
+    static const uint64_t TX_BUSOFF_BACKOFF_NS = 1000000000; // After #8
+
+    // One adapter. The RX thread serves all channels in one event loop, so
+    // records of all adapters are handled in the order they arrive. Each
+    // channel has its own TX thread, queue and send window.
+    struct Channel
+    {
+        int index;
+        std::string tty_path;
+        std::string name; // TTY name, e.g. ttyACM0, used as candump interface
+        int fd;
+        struct termios old_tty_settings;
+        struct serial_struct old_serial; // Restored if low latency mode was set
+        bool serial_changed;
+        RxFramer rx_framer;
+
+        std::thread tx_thread;
+        int tx_wake_fd; // eventfd used by producers to wake up the TX thread
+        TxQueue tx_queue;
+        std::atomic<bool> tx_idle; // TX thread is about to sleep / sleeping
+
+        // TX statistics, written by the TX thread
+        std::atomic<uint64_t> tx_commands; // Also read by wait_tx_drain()
+        uint64_t tx_writes;
+        uint64_t tx_partial_writes;
+        uint64_t tx_eagain;
+
+        std::atomic<unsigned> next_marker;
+        std::atomic<uint64_t> marker_sent_ns[MARKER_COUNT]; // 0 = no echo pending
+        std::atomic<uint64_t> markers_sent;
+        std::atomic<uint64_t> markers_lost;      // Marker reused before its echo arrived
+        std::atomic<uint64_t> markers_unmatched; // Echo without a pending marker
+        LatencyHistogram echo_latency;           // Written by the RX thread only
+
+        std::atomic<unsigned> adapter_modes;
+
+        unsigned tx_window_max; // 0 = no flow control
+        std::atomic<unsigned> tx_window;
+        std::atomic<int> tx_in_flight;
+        std::atomic<uint64_t> tx_backoff_until; // TX thread pauses until then
+        uint64_t tx_backoff_ns;                 // RX thread only
+        unsigned tx_window_acks;                // RX thread only
+        SpscRing<SentCommand> tx_pending;       // TX -> RX: commands waiting for feedback
+        std::atomic<bool> tx_pending_void[TX_PENDING_SIZE]; // Entry was never written, no feedback comes
+        SpscRing<SentCommand> tx_retry;         // RX -> TX: frames rejected with #7/#8
+        std::atomic<uint64_t> tx_enqueued;
+        std::atomic<uint64_t> tx_retried;
+        std::atomic<uint64_t> tx_rejected; // Given up after TX_MAX_RETRIES
+        std::atomic<uint64_t> tx_stale;
+
+        std::unique_ptr<IdStatsTable> id_stats; // --stats only
+        std::atomic<int> bus_load;              // Last L<nn> report in percent, -1 = none yet
+        std::atomic<uint64_t> bus_load_ns;
+
+        // --reconnect: while the adapter is away fd refers to /dev/null
+        std::string reopen_path; // /dev/serial/by-id link if there is one
+        std::atomic<bool> connected;
+        std::atomic<unsigned> disconnects; // Counted by the RX thread, shown by the dashboards
+        uint64_t disconnected_ns;
+        unsigned reconnects;
+        uint64_t gap_ns; // Total time without the adapter
+
+        Channel(int idx, const std::string &tty, unsigned window)
+            : index(idx), tty_path(tty), fd(-1), serial_changed(false), tx_wake_fd(-1), tx_queue(TX_QUEUE_SIZE), tx_idle(false),
+              tx_commands(0), tx_writes(0), tx_partial_writes(0), tx_eagain(0), next_marker(0),
+              markers_sent(0), markers_lost(0), markers_unmatched(0), adapter_modes(0),
+              tx_window_max(window), tx_window(window), tx_in_flight(0), tx_backoff_until(0), tx_backoff_ns(0),
+              tx_window_acks(0), tx_pending(TX_PENDING_SIZE), tx_retry(MARKER_COUNT),
+              tx_enqueued(0), tx_retried(0), tx_rejected(0), tx_stale(0), bus_load(-1), bus_load_ns(0),
+              connected(true), disconnects(0), disconnected_ns(0), reconnects(0), gap_ns(0)
+        {
+            size_t slash = tty.find_last_of('/');
+            name = (slash == std::string::npos) ? tty : tty.substr(slash + 1);
+            for (int i = 0; i < MARKER_COUNT; i++)
+            {
+                marker_sent_ns[i].store(0, std::memory_order_relaxed);
+            }
+            for (size_t i = 0; i < TX_PENDING_SIZE; i++)
+            {
+                tx_pending_void[i].store(false, std::memory_order_relaxed);
+            }
+        }
+    };
+    std::vector<std::unique_ptr<Channel>> channels;
+
+    int epoll_fd;
+    int stop_fd; // eventfd used by stop() to wake up the RX thread
+
+    // --reconnect: the hotplug thread follows the directories of the
+    // adapters' paths with inotify and reopens an adapter that has gone away
+    // as soon as its path is back, then repeats the init commands
+    bool reconnect;
+    std::vector<std::string> reconnect_init;
+    std::vector<std::string> hotplug_dirs;
+    int hotplug_fd;      // inotify
+    int hotplug_wake_fd; // eventfd used by the RX thread after a disconnect
+    std::thread hotplug_thread;
+    int display_wake_fd; // eventfd used by the RX thread to wake up the display thread
+    std::atomic<bool> running;
+    std::thread rx_thread;
+    std::thread display_thread;
+    std::atomic<bool> tx_active;
+
+    // Console output, filled by the RX thread and rendered by the display thread
+    SpscRing<DisplayItem> display_queue;
+    std::atomic<uint64_t> display_dropped;
+    std::atomic<bool> display_idle;
+    std::atomic<bool> display_active;
+    NoticeQueue notices; // Lines of the other threads, see notice()
+    bool interactive; // Redraw the input prompt after each update
+
+    // Serial reception: --low-latency, --read-mode and -t
+    bool low_latency;
+    bool spin_reads;      // RX thread polls without sleeping
+    char timestamp_mode;  // 0 = none, a = absolute, z = since start, d = since the previous record
+    int64_t wall_offset_ns; // CLOCK_REALTIME - CLOCK_MONOTONIC at start_io()
+    uint64_t start_ns;
+
+    // Pre-encoded frames of a replay log
+    struct ReplayFrame
+    {
+        uint64_t offset_ns; // Time relative to the first frame of the log
+        size_t channel;     // Interfaces of the log map to channels in order
+        size_t pos;         // Encoded command in replay_data
+        size_t len;
+    };
+    std::vector<ReplayFrame> replay_frames;
+    std::string replay_data;
+
+    std::unique_ptr<CaptureLog> capture_log;
+    std::unique_ptr<TriggerCapture> trigger;
+
+    // --dbc: frames described by the DBC are shown as signal values
+    std::unique_ptr<DbcDecoder> dbc;
+
+    // --shm: received frames for other processes, filled by the RX thread
+    std::unique_ptr<SlcanShmWriter> shm_ring;
+
+    // --filter: rejected frames are dropped before logging, statistics and display
+    std::unique_ptr<FrameFilter> frame_filter;
+    uint64_t frames_filtered; // Written by the RX thread
+
+    // Cyclic transmit scheduler. Messages added with "cyclic add" sit in a
+    // timer wheel advanced by a timerfd every CYCLIC_TICK_NS. The scheduler
+    // thread hands all frames due in one tick to the TX queues together and
+    // wakes each TX thread once. The timer only runs while messages do.
+    static const uint64_t CYCLIC_TICK_NS = 1000000;
+    static const uint64_t CYCLIC_MAX_PERIOD_NS = 3600000000000ull; // Well within the wheel's range
+    struct CyclicMessage
+    {
+        bool used;
+        bool running;
+        int channel;            // -1 = all channels
+        uint64_t period_ticks;
+        uint64_t next_tick;
+        uint64_t last_batch;    // Wake-up that sent it last, catching up sends once
+        std::string text;       // As entered
+        std::string command;    // Encoded SLCAN frame incl. \r
+        int counter_pos;        // Hex digits of the counter byte in command, -1 = none
+        uint8_t counter_mask;   // Counter bits of that byte
+        uint64_t sent;
+        uint64_t overruns;      // Ticks missed because the scheduler woke up late
+        uint64_t queue_full;    // Frames dropped because a TX queue was full
+        uint64_t last_ns;
+        uint64_t intervals;     // Jitter = interval between two sends - period
+        int64_t jitter_min_ns;
+        int64_t jitter_max_ns;
+        uint64_t jitter_abs_ns; // Sum of |jitter|
+    };
+    std::vector<CyclicMessage> cyclic_messages; // Index = wheel handle, shown as index + 1
+    TimerWheel cyclic_wheel;
+    std::mutex cyclic_mutex;
+    std::thread cyclic_thread;
+    int cyclic_timer_fd;
+    size_t cyclic_running;
+    uint64_t cyclic_batches;
+
+    // Init commands wait for the adapter's answer (#, #<code> or +<text>) once
+    // MF is on, without feedback the responses are collected for a fixed time
+    static const uint64_t INIT_FEEDBACK_TIMEOUT_NS = 1000000000;
+    static const uint64_t INIT_FALLBACK_DELAY_NS = 100000000;
+
+    // --stats dashboard: frames only update the channel's table, the display
+    // thread redraws it at a fixed rate together with the last other records
+    static const uint64_t STATS_INTERVAL_NS = 500000000;
+    static const size_t STATS_RECENT = 5;
+    bool stats_enabled;
+    // --sniff uses the same tables, drawn by sniff_view at a higher rate
+    static const uint64_t SNIFF_INTERVAL_NS = 50000000;
+    std::unique_ptr<SniffView> sniff_view;
+    std::mutex prompt_mutex;
+    std::string prompt_input; // Current input line, redrawn with the dashboard
+
+    // --bench: frames with the benchmark ID are counted by the RX thread
+    // instead of being displayed. The first 4 data bytes carry a sequence
+    // number when the frame is long enough. Only the first channel sends.
+    struct BenchRx
+    {
+        std::atomic<bool> active;
+        uint32_t id;
+        bool extended;
+        uint32_t next_seq;
+        std::atomic<uint64_t> frames;
+        std::atomic<uint64_t> data_bytes;
+        std::atomic<uint64_t> serial_bytes;
+        std::atomic<uint64_t> reordered; // Sequence number lower than expected
+        std::atomic<uint64_t> last_ns;   // Receive time of the last frame
+        std::atomic<uint64_t> error_reports;
+        std::atomic<unsigned> error_flags; // Firmware flags of all E reports, ORed
+        std::string last_error;            // Read after the RX thread is joined
+
+        BenchRx()
+            : active(false), id(0), extended(false), next_seq(0), frames(0), data_bytes(0), serial_bytes(0),
+              reordered(0), last_ns(0), error_reports(0), error_flags(0) {}
+    } bench;
+
+    struct termios old_stdin_settings;
+
+    // "[RX]" with one adapter, "[RX<n>]" with several
+    std::string tag(const char *prefix, int channel) const
+    {
+        std::string text = "[";
+        text += prefix;
+        if (channels.size() > 1)
+        {
+            text += std::to_string(channel);
+        }
+        return text + "]";
+    }
+
+    void setup_serial_port(Channel &ch)
+    {
+        struct termios tty;
+
+        // Get current settings
+        if (tcgetattr(ch.fd, &tty) < 0)
+        {
+            perror("tcgetattr");
+            exit(EXIT_FAILURE);
+        }
+
+        // Save old settings
+        ch.old_tty_settings = tty;
+
+        // Configure serial port for raw mode
+        cfmakeraw(&tty);
+
+        // Set baud rate to 115200 (common for SLCAN devices)
+        cfsetospeed(&tty, B115200);
+        cfsetispeed(&tty, B115200);
+
+        // 8N1 mode
+        tty.c_cflag &= ~PARENB; // No parity
+        tty.c_cflag &= ~CSTOPB; // 1 stop bit
+        tty.c_cflag &= ~CSIZE;
+        tty.c_cflag |= CS8;            // 8 data bits
+        tty.c_cflag |= CREAD | CLOCAL; // Enable receiver, ignore modem control
+
+        // No hardware flow control
+        tty.c_cflag &= ~CRTSCTS;
+
+        // No software flow control
+        tty.c_iflag &= ~(IXON | IXOFF | IXANY);
+
+        // Raw output
+        tty.c_oflag &= ~OPOST;
+
+        // Non-canonical mode, no echo
+        tty.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
+
+        // Read settings: return whatever is available without waiting,
+        // the RX thread blocks in epoll_wait() instead
+        tty.c_cc[VMIN] = 0;
+        tty.c_cc[VTIME] = 0;
+
+        if (tcsetattr(ch.fd, TCSANOW, &tty) < 0)
+        {
+            perror("tcsetattr");
+            exit(EXIT_FAILURE);
+        }
+
+        // Flush any existing data
+        tcflush(ch.fd, TCIOFLUSH);
+
+        if (low_latency)
+        {
+            set_serial_low_latency(ch);
+        }
+    }
+
+    // Asks the driver to hand received bytes to the TTY layer at once
+    // instead of collecting them, e.g. the 16 ms latency timer of FTDI
+    // adapters. Drivers without TIOCSSERIAL keep their default.
+    void set_serial_low_latency(Channel &ch)
+    {
+        struct serial_struct serial;
+        if (ioctl(ch.fd, TIOCGSERIAL, &serial) < 0)
+        {
+            std::cerr << "Warning: " << ch.tty_path << " - low latency mode not supported: " << strerror(errno)
+                      << std::endl;
+            return;
+        }
+        ch.old_serial = serial;
+        serial.flags |= ASYNC_LOW_LATENCY;
+        if (ioctl(ch.fd, TIOCSSERIAL, &serial) < 0)
+        {
+            std::cerr << "Warning: " << ch.tty_path << " - cannot set low latency mode: " << strerror(errno)
+                      << std::endl;
+            return;
+        }
+        ch.serial_changed = true;
+    }
+
+    void setup_stdin()
+    {
+        struct termios tty;
+
+        // Get current stdin settings
+        if (tcgetattr(STDIN_FILENO, &tty) < 0)
+        {
+            perror("tcgetattr stdin");
+            exit(EXIT_FAILURE);
+        }
+
+        // Save old settings
+        old_stdin_settings = tty;
+
+        // Set stdin to raw mode for character-by-character input
+        tty.c_lflag &= ~(ICANON | ECHO);
+        tty.c_cc[VMIN] = 1;
+        tty.c_cc[VTIME] = 0;
+
+        if (tcsetattr(STDIN_FILENO, TCSANOW, &tty) < 0)
+        {
+            perror("tcsetattr stdin");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    void restore_stdin()
+    {
+        tcsetattr(STDIN_FILENO, TCSANOW, &old_stdin_settings);
+    }
+
+    void restore_serial(Channel &ch)
+    {
+        if (ch.fd >= 0)
+        {
+            tcsetattr(ch.fd, TCSANOW, &ch.old_tty_settings);
+            if (ch.serial_changed)
+            {
+                ioctl(ch.fd, TIOCSSERIAL, &ch.old_serial);
+            }
+        }
+    }
+
+    // "(seconds) " in front of a displayed record, see timestamp_mode.
+    // previous holds the time of the record before, for mode d.
+    std::string timestamp_text(uint64_t ts, uint64_t &previous)
+    {
+        char text[40];
+        uint64_t value;
+        switch (timestamp_mode)
+        {
+        case 'a':
+            value = ts + wall_offset_ns;
+            snprintf(text, sizeof(text), "(%010llu.%06llu) ", (unsigned long long)(value / 1000000000ull),
+                     (unsigned long long)(value % 1000000000ull / 1000));
+            return text;
+        case 'z':
+        case 'd':
+            value = ts - (timestamp_mode == 'z' ? start_ns : (previous ? previous : ts));
+            previous = ts;
+            snprintf(text, sizeof(text), "(%03llu.%06llu) ", (unsigned long long)(value / 1000000000ull),
+                     (unsigned long long)(value % 1000000000ull / 1000));
+            return text;
+        default:
+            return "";
+        }
+    }
+
+    // Queues a record for the display thread. Never blocks: if the console
+    // cannot keep up the record is counted as not displayed.
+    void display_record(const SlcanRecord &msg, uint64_t rx_time, int channel,
+                        uint8_t kind = DisplayItem::RECORD)
+    {
+        DisplayItem item;
+        item.timestamp_ns = rx_time;
+        item.channel = (uint8_t)channel;
+        item.kind = kind;
+        item.len = (uint8_t)std::min(msg.len, sizeof(item.text));
+        memcpy(item.text, msg.data, item.len);
+
+        if (!display_queue.push(item))
+        {
+            display_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (display_idle.exchange(false))
+        {
+            signal_eventfd(display_wake_fd);
+        }
+    }
+
+    // Console line of a thread other than RX: goes through the display
+    // thread while it runs, straight to the console otherwise
+    void notice(const std::string &line, bool error = false)
+    {
+        if (display_active.load(std::memory_order_acquire))
+        {
+            notices.post(line);
+        }
+        else if (error)
+        {
+            std::cerr << line << std::endl;
+        }
+        else
+        {
+            std::cout << line << std::endl;
+        }
+    }
+
+    void handle_frame(Channel &ch, const CanFrame &frame, const SlcanRecord &msg)
+    {
+        if (capture_log)
+        {
+            capture_log->push(frame);
+        }
+        if (trigger && trigger->push(frame, msg) && trigger->frames_after() > 0)
+        {
+            display_record(msg, frame.timestamp_ns, ch.index, DisplayItem::TRIGGER);
+        }
+        if (shm_ring)
+        {
+            SlcanShmFrame &out = shm_ring->begin();
+            out.timestamp_ns = frame.timestamp_ns;
+            out.id = frame.id;
+            out.flags = frame.flags;
+            out.dlc = frame.dlc;
+            out.len = frame.len;
+            out.channel = frame.channel;
+            memcpy(out.data, frame.data, frame.len);
+            shm_ring->publish();
+        }
+
+        if (bench.active && ch.index == 0 && frame.id == bench.id &&
+            ((frame.flags & CAN_FLAG_EXT) != 0) == bench.extended)
+        {
+            count_bench_frame(frame, msg);
+            return;
+        }
+        if (ch.id_stats)
+        {
+            ch.id_stats->update(frame);
+            return;
+        }
+        display_record(msg, frame.timestamp_ns, ch.index);
+    }
+
+    void handle_record(Channel &ch, const SlcanRecord &msg, uint64_t rx_time)
+    {
+        CanFrame frame;
+        if (decode_slcan_frame(msg.data, msg.len, frame))
+        {
+            frame.timestamp_ns = rx_time;
+            frame.channel = (uint8_t)ch.index;
+            if (frame_filter && !frame_filter->pass(frame))
+            {
+                frames_filtered++;
+                return;
+            }
+            handle_frame(ch, frame, msg);
+            return;
+        }
+
+        if (msg.len == 3 && msg.data[0] == 'M')
+        {
+            handle_tx_echo(ch, msg, rx_time);
+        }
+        else if (msg.data[0] == '#' || msg.data[0] == '+')
+        {
+            handle_feedback(ch, msg, rx_time);
+        }
+        else if (msg.data[0] == 'E' && bench.active && ch.index == 0)
+        {
+            uint8_t raw[4];
+            if (msg.len >= 9 && decode_hex_bytes(msg.data + 1, raw, 4))
+            {
+                bench.error_reports.fetch_add(1, std::memory_order_relaxed);
+                bench.error_flags.fetch_or(raw[1], std::memory_order_relaxed);
+                bench.last_error.assign(msg.data, msg.len);
+            }
+        }
+        else if (msg.data[0] == 'L')
+        {
+            int load = parse_bus_load(msg);
+            if (load >= 0)
+            {
+                ch.bus_load = load;
+                ch.bus_load_ns = rx_time;
+            }
+        }
+        // Without frames to wait for, the capture is already with the
+        // writer, which reports it
+        if (trigger && trigger->check_record(msg) && trigger->frames_after() > 0)
+        {
+            display_record(msg, rx_time, ch.index, DisplayItem::TRIGGER);
+        }
+        display_record(msg, rx_time, ch.index);
+    }
+
+    // Console line of a DisplayItem::TRIGGER item, without the newline
+    std::string trigger_text(const DisplayItem &item) const
+    {
+        SlcanRecord msg = {item.text, item.len};
+        return tag("TRIG", item.channel) + " " + std::string(item.text, item.len) + get_record_description(msg) +
+               " - capturing " + std::to_string(trigger->frames_after()) + " more frames";
+    }
+
+    std::string gap_text(const DisplayItem &item) const
+    {
+        const Channel &ch = *channels[item.channel];
+        std::string text = tag("GAP", item.channel) + " " + ch.tty_path + " disconnected";
+        if (item.len > 0)
+        {
+            text += ": " + std::string(item.text, item.len);
+        }
+        return text + " - waiting for " + ch.reopen_path;
+    }
+
+    // Disconnects so far for the dashboard headers, empty if there were none
+    std::string gap_status() const
+    {
+        unsigned gaps = 0;
+        std::string away;
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            gaps += channels[c]->disconnects.load(std::memory_order_relaxed);
+            if (!channels[c]->connected.load(std::memory_order_relaxed))
+            {
+                away += " " + channels[c]->name;
+            }
+        }
+        if (gaps == 0)
+        {
+            return std::string();
+        }
+        return "   Gaps: " + std::to_string(gaps) + (away.empty() ? "" : " (disconnected:" + away + ")");
+    }
+
+    void count_bench_frame(const CanFrame &frame, const SlcanRecord &msg)
+    {
+        bench.frames.fetch_add(1, std::memory_order_relaxed);
+        bench.data_bytes.fetch_add(frame.len, std::memory_order_relaxed);
+        bench.serial_bytes.fetch_add(msg.len + 1, std::memory_order_relaxed);
+        bench.last_ns.store(frame.timestamp_ns, std::memory_order_relaxed);
+        if (frame.len < 4)
+        {
+            return;
+        }
+
+        uint32_t seq = ((uint32_t)frame.data[0] << 24) | ((uint32_t)frame.data[1] << 16) |
+                       ((uint32_t)frame.data[2] << 8) | frame.data[3];
+        if ((int32_t)(seq - bench.next_seq) >= 0)
+        {
+            bench.next_seq = seq + 1; // Gaps are lost frames, counted at the end
+        }
+        else
+        {
+            bench.reordered.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Matches an M<xx> echo with the send time of its marker
+    void handle_tx_echo(Channel &ch, const SlcanRecord &msg, uint64_t rx_time)
+    {
+        uint8_t hi = hex_table.value[(uint8_t)msg.data[1]];
+        uint8_t lo = hex_table.value[(uint8_t)msg.data[2]];
+        if ((hi | lo) & 0xF0)
+        {
+            return;
+        }
+
+        // A stamp newer than the echo belongs to a later use of the marker
+        std::atomic<uint64_t> &stamp = ch.marker_sent_ns[(hi << 4) | lo];
+        uint64_t sent = stamp.load(std::memory_order_relaxed);
+        if (sent == 0 || sent > rx_time || !stamp.compare_exchange_strong(sent, 0, std::memory_order_relaxed))
+        {
+            ch.markers_unmatched.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        ch.echo_latency.record(rx_time - sent);
+        if (ch.tx_window_max > 0)
+        {
+            release_tx_credit(ch, true);
+            wake_tx(ch);
+        }
+    }
+
+    // Pairs a feedback (# code or +text) with the oldest command that waits
+    // for one. The adapter answers strictly in order.
+    void handle_feedback(Channel &ch, const SlcanRecord &msg, uint64_t rx_time)
+    {
+        skip_void_pending(ch);
+        if (ch.tx_pending.size() == 0)
+        {
+            return;
+        }
+        const SentCommand &cmd = ch.tx_pending.peek(0);
+        char code = (msg.data[0] == '#' && msg.len > 1) ? msg.data[1] : 0;
+
+        if ((cmd.flags & TX_FLAG_CREDIT) && (code == '7' || code == '8'))
+        {
+            reject_tx_frame(ch, cmd, code, rx_time);
+        }
+        else if ((cmd.flags & TX_FLAG_CREDIT) && cmd.marker < 0)
+        {
+            release_tx_credit(ch, code == 0);
+        }
+        pop_pending(ch);
+
+        // Either a credit or a FIFO entry became free
+        wake_tx(ch);
+    }
+
+    // Releases the oldest pending command
+    void pop_pending(Channel &ch)
+    {
+        ch.tx_pending_void[ch.tx_pending.consumed() & (TX_PENDING_SIZE - 1)].store(false, std::memory_order_relaxed);
+        ch.tx_pending.consume(1);
+    }
+
+    // Drops the oldest pending commands that the TX thread could not write,
+    // drop_tx_batch() already gave back their credits
+    void skip_void_pending(Channel &ch)
+    {
+        while (ch.tx_pending.size() > 0 &&
+               ch.tx_pending_void[ch.tx_pending.consumed() & (TX_PENDING_SIZE - 1)].exchange(false, std::memory_order_acquire))
+        {
+            ch.tx_pending.consume(1);
+        }
+    }
+
+    // #7 (Tx buffer full) or #8 (bus off): the frame never reaches the bus.
+    // Shrink the window, pause the TX thread and queue the frame again.
+    void reject_tx_frame(Channel &ch, const SentCommand &cmd, char code, uint64_t rx_time)
+    {
+        // No echo will come for a rejected frame
+        bool credited = cmd.marker < 0 || ch.marker_sent_ns[cmd.marker].exchange(0, std::memory_order_relaxed) != 0;
+
+        if (code == '7')
+        {
+            ch.tx_window.store(std::max(1u, ch.tx_window.load(std::memory_order_relaxed) / 2), std::memory_order_relaxed);
+            uint64_t backoff = ch.tx_backoff_ns ? ch.tx_backoff_ns * 2 : TX_BACKOFF_MIN_NS;
+            ch.tx_backoff_ns = backoff < TX_BACKOFF_MAX_NS ? backoff : TX_BACKOFF_MAX_NS;
+            ch.tx_backoff_until.store(rx_time + ch.tx_backoff_ns, std::memory_order_relaxed);
+        }
+        else
+        {
+            ch.tx_backoff_until.store(rx_time + TX_BUSOFF_BACKOFF_NS, std::memory_order_relaxed);
+        }
+        ch.tx_window_acks = 0;
+
+        SentCommand retry = cmd;
+        retry.retries++;
+        if (cmd.retries >= TX_MAX_RETRIES || !ch.tx_retry.push(retry))
+        {
+            ch.tx_rejected.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if (credited)
+        {
+            release_tx_credit(ch, false);
+        }
+    }
+
+    // Returns one credit of the send window, an acknowledged frame also
+    // grows the window. The caller wakes up the TX thread.
+    void release_tx_credit(Channel &ch, bool acked)
+    {
+        if (acked)
+        {
+            ch.tx_backoff_ns = 0;
+            unsigned window = ch.tx_window.load(std::memory_order_relaxed);
+            if (++ch.tx_window_acks >= window && window < ch.tx_window_max)
+            {
+                ch.tx_window.store(window + 1, std::memory_order_relaxed);
+                ch.tx_window_acks = 0;
+            }
+        }
+        ch.tx_in_flight.fetch_sub(1, std::memory_order_release);
+    }
+
+    void wake_tx(Channel &ch)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (ch.tx_idle.exchange(false))
+        {
+            signal_eventfd(ch.tx_wake_fd);
+        }
+    }
+
+    // Gives up on answers that did not come within TX_STALE_NS, e.g. because
+    // the adapter was reset, so that a lost answer never blocks the window
+    void expire_tx_credits(Channel &ch, uint64_t now)
+    {
+        uint64_t stale = ch.tx_stale.load(std::memory_order_relaxed);
+        uint64_t lost = ch.markers_lost.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            skip_void_pending(ch);
+            if (ch.tx_pending.size() == 0)
+                break;
+            const SentCommand &cmd = ch.tx_pending.peek(0);
+            if (cmd.sent_ns > now || now - cmd.sent_ns < TX_STALE_NS)
+                break;
+            if ((cmd.flags & TX_FLAG_CREDIT) && cmd.marker < 0)
+            {
+                release_tx_credit(ch, false);
+            }
+            pop_pending(ch);
+            ch.tx_stale.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        for (int i = 0; i < MARKER_COUNT; i++)
+        {
+            uint64_t sent = ch.marker_sent_ns[i].load(std::memory_order_relaxed);
+            if (sent == 0 || sent > now || now - sent < TX_STALE_NS)
+                continue;
+            if (ch.marker_sent_ns[i].compare_exchange_strong(sent, 0, std::memory_order_relaxed))
+            {
+                ch.markers_lost.fetch_add(1, std::memory_order_relaxed);
+                if (ch.tx_window_max > 0)
+                {
+                    release_tx_credit(ch, false);
+                }
+            }
+        }
+
+        if (ch.tx_stale.load(std::memory_order_relaxed) != stale || ch.markers_lost.load(std::memory_order_relaxed) != lost)
+        {
+            wake_tx(ch);
+        }
+    }
+
+    // Renders queued records in batches: one write() per update and at most
+    // one update every DISPLAY_INTERVAL_NS, so a slow terminal only delays
+    // the console and never the serial reads.
+    void display_thread_func()
+    {
+        std::string out;
+        out.reserve(256 * 1024);
+        std::deque<std::string> lines;
+        uint64_t shown_dropped = 0;
+        uint64_t last_update = 0;
+        uint64_t previous_ts = 0;
+
+        for (;;)
+        {
+            size_t count = display_queue.size();
+            uint64_t dropped = display_dropped.load(std::memory_order_relaxed);
+
+            if (count == 0 && dropped == shown_dropped && notices.empty())
+            {
+                if (!display_active)
+                    break;
+
+                // Announce the sleep, then check once more so that a record
+                // pushed in between is not missed
+                display_idle.store(true);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (display_queue.size() == 0 && notices.empty() && display_active)
+                {
+                    struct pollfd pfd;
+                    pfd.fd = display_wake_fd;
+                    pfd.events = POLLIN;
+                    pfd.revents = 0;
+                    poll(&pfd, 1, -1);
+                    uint64_t value;
+                    ssize_t r = read(display_wake_fd, &value, sizeof(value));
+                    (void)r;
+                }
+                display_idle.store(false);
+                continue;
+            }
+
+            // Cap the refresh rate, records arriving meanwhile join the batch
+            uint64_t now = monotonic_ns();
+            if (now - last_update < DISPLAY_INTERVAL_NS && display_active)
+            {
+                usleep((DISPLAY_INTERVAL_NS - (now - last_update)) / 1000);
+                continue;
+            }
+
+            out.clear();
+            for (size_t i = 0; i < count; i++)
+            {
+                const DisplayItem &item = display_queue.peek(i);
+                SlcanRecord msg = {item.text, item.len};
+
+                out += "\r\033[K";
+                if (item.kind == DisplayItem::TRIGGER)
+                {
+                    out += trigger_text(item) + "\n";
+                    continue;
+                }
+                if (item.kind == DisplayItem::GAP)
+                {
+                    out += gap_text(item) + "\n";
+                    continue;
+                }
+                if (timestamp_mode)
+                {
+                    out += timestamp_text(item.timestamp_ns, previous_ts);
+                }
+                out += tag("RX", item.channel) + " ";
+                CanFrame frame;
+                if (!dbc || !decode_slcan_frame(item.text, item.len, frame) || !dbc->format(frame, out))
+                {
+                    out.append(item.text, item.len);
+                    out += get_record_description(msg);
+                }
+                out += '\n';
+            }
+            display_queue.consume(count);
+
+            // Records are dropped when the queue is full, so they are newer
+            // than the ones shown above
+            if (dropped != shown_dropped)
+            {
+                out += "\r\033[K[RX] ... " + std::to_string(dropped - shown_dropped) + " frames not displayed\n";
+                shown_dropped = dropped;
+            }
+
+            notices.take(lines);
+            for (size_t i = 0; i < lines.size(); i++)
+            {
+                out += "\r\033[K" + lines[i] + "\n";
+            }
+            lines.clear();
+
+            if (interactive)
+            {
+                out += "> ";
+            }
+            write_all(STDOUT_FILENO, out.data(), out.size());
+            last_update = monotonic_ns();
+        }
+    }
+
+    // Replaces display_thread_func() with --stats and --sniff: redraws the
+    // per-ID table every STATS_INTERVAL_NS (SNIFF_INTERVAL_NS), records that
+    // are not frames are kept for the lines below it
+    void stats_thread_func()
+    {
+        uint64_t interval = sniff_view ? SNIFF_INTERVAL_NS : STATS_INTERVAL_NS;
+        std::vector<IdStatsTable::Entry> entries;
+        std::vector<IdStatsTable::Entry> part;
+        std::deque<std::string> recent;
+        std::string out;
+        uint64_t last_update = monotonic_ns();
+        uint64_t next_update = last_update;
+
+        while (display_active)
+        {
+            size_t count = display_queue.size();
+            for (size_t i = 0; i < count; i++)
+            {
+                const DisplayItem &item = display_queue.peek(i);
+                SlcanRecord msg = {item.text, item.len};
+                if (item.kind == DisplayItem::TRIGGER)
+                {
+                    recent.push_back(trigger_text(item));
+                }
+                else if (item.kind == DisplayItem::GAP)
+                {
+                    recent.push_back(gap_text(item));
+                }
+                else
+                {
+                    recent.push_back(tag("RX", item.channel) + " " + std::string(item.text, item.len) +
+                                     get_record_description(msg));
+                }
+                if (recent.size() > STATS_RECENT)
+                {
+                    recent.pop_front();
+                }
+            }
+            display_queue.consume(count);
+
+            if (!notices.empty())
+            {
+                notices.take(recent);
+                while (recent.size() > STATS_RECENT)
+                {
+                    recent.pop_front();
+                }
+            }
+
+            uint64_t now = monotonic_ns();
+            if (now >= next_update)
+            {
+                entries.clear();
+                for (size_t c = 0; c < channels.size(); c++)
+                {
+                    channels[c]->id_stats->snapshot(part);
+                    entries.insert(entries.end(), part.begin(), part.end());
+                }
+                if (sniff_view)
+                {
+                    render_sniff(entries, now, recent, out);
+                }
+                else
+                {
+                    render_stats(entries, now, now - last_update, recent, out);
+                }
+                write_all(STDOUT_FILENO, out.data(), out.size());
+                last_update = now;
+                next_update = now + interval;
+            }
+
+            struct pollfd pfd;
+            pfd.fd = display_wake_fd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            if (poll(&pfd, 1, (int)((next_update - now) / 1000000) + 1) > 0)
+            {
+                uint64_t value;
+                ssize_t r = read(display_wake_fd, &value, sizeof(value));
+                (void)r;
+            }
+        }
+    }
+
+    // One bus load per channel, from the adapters' L records
+    std::string bus_load_text(uint64_t now) const
+    {
+        std::string text;
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            const Channel &ch = *channels[c];
+            int load = ch.bus_load;
+            text += c ? " / " : "";
+            if (load < 0)
+            {
+                text += "-";
+                continue;
+            }
+            text += std::to_string(load) + "%";
+            uint64_t age = (now - ch.bus_load_ns) / 1000000000ull;
+            if (age >= 2)
+            {
+                text += " (" + std::to_string(age) + " s ago)";
+            }
+        }
+        return text;
+    }
+
+    static void terminal_size(int &cols, int &rows)
+    {
+        cols = 80;
+        rows = 24;
+        struct winsize ws;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0)
+        {
+            cols = ws.ws_col;
+            rows = ws.ws_row;
+        }
+    }
+
+    void render_sniff(const std::vector<IdStatsTable::Entry> &entries, uint64_t now,
+                      const std::deque<std::string> &recent, std::string &out)
+    {
+        std::vector<std::string> header(1, "=== SLCAN sniffer:");
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            header[0] += " " + channels[c]->tty_path;
+        }
+        header[0] += " ===   Bus load: " + bus_load_text(now) + gap_status();
+
+        int cols;
+        int rows;
+        terminal_size(cols, rows);
+        std::string prompt;
+        if (interactive)
+        {
+            std::lock_guard<std::mutex> lock(prompt_mutex);
+            prompt = prompt_input;
+        }
+        sniff_view->render(entries, channels.size() > 1, now, header, recent, interactive, prompt, cols, rows, out);
+    }
+
+    void render_stats(const std::vector<IdStatsTable::Entry> &entries, uint64_t now, uint64_t elapsed,
+                      const std::deque<std::string> &recent, std::string &out)
+    {
+        char line[256];
+        double seconds = elapsed / 1e9;
+        uint64_t total = 0;
+        uint64_t delta = 0;
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            total += entries[i].count;
+            delta += entries[i].count - entries[i].shown_count;
+        }
+
+        int cols;
+        int rows;
+        terminal_size(cols, rows);
+
+        out.assign("\033[H");
+        out += "=== SLCAN statistics:";
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            out += " " + channels[c]->tty_path;
+        }
+        out += " ===\033[K\n";
+
+        snprintf(line, sizeof(line), "IDs: %zu   Frames: %llu   Frames/s: %.1f   Bus load: %s",
+                 entries.size(), (unsigned long long)total, delta / seconds, bus_load_text(now).c_str());
+        out += line;
+        uint64_t untracked = 0;
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            untracked += channels[c]->id_stats->untracked_frames();
+        }
+        if (untracked > 0)
+        {
+            out += "   Untracked: " + std::to_string(untracked) + " frames (too many IDs)";
+        }
+        out += gap_status();
+        out += "\033[K\n";
+        bool multi = channels.size() > 1;
+        out += multi ? "Ch " : "";
+        out += "      ID DLC      Count  Frames/s  Min [ms] Mean [ms]  Max [ms]   Chg/s  Data\033[K\n";
+
+        // Header, separator, recent records and prompt take the other rows
+        int space = rows - 3 - (int)recent.size() - 2;
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            if ((int)i >= space - 1 && i + 1 < entries.size())
+            {
+                snprintf(line, sizeof(line), "  ... %zu more IDs\033[K\n", entries.size() - i);
+                out += line;
+                break;
+            }
+
+            const IdStatsTable::Entry &e = entries[i];
+            char id[16];
+            snprintf(id, sizeof(id), e.extended ? "%08X" : "%03X", e.id);
+            int n = multi ? snprintf(line, sizeof(line), "%2u ", e.channel) : 0;
+            n += snprintf(line + n, sizeof(line) - n, "%8s %3X %10llu %9.1f ", id, e.dlc, (unsigned long long)e.count,
+                          (e.count - e.shown_count) / seconds);
+            if (e.count > 1)
+            {
+                n += snprintf(line + n, sizeof(line) - n, "%9.3f %9.3f %9.3f ", e.min_gap_ns / 1e6,
+                              (e.last_ns - e.first_ns) / 1e6 / (e.count - 1), e.max_gap_ns / 1e6);
+            }
+            else
+            {
+                n += snprintf(line + n, sizeof(line) - n, "%9s %9s %9s ", "-", "-", "-");
+            }
+            n += snprintf(line + n, sizeof(line) - n, "%7.1f ", (e.changes - e.shown_changes) / seconds);
+
+            // The first 8 data bytes, enough for classic frames
+            size_t shown = std::min<size_t>(e.len, 8);
+            for (size_t b = 0; b < shown; b++)
+            {
+                line[n++] = ' ';
+                line[n++] = hex_upper[e.data[b] >> 4];
+                line[n++] = hex_upper[e.data[b] & 0x0F];
+            }
+            out.append(line, n);
+            if (e.len > shown)
+            {
+                out += " ...";
+            }
+            out += "\033[K\n";
+        }
+
+        out += "\033[K\n";
+        for (size_t i = 0; i < recent.size(); i++)
+        {
+            out += recent[i] + "\033[K\n";
+        }
+        out += "\033[J";
+
+        if (interactive)
+        {
+            std::lock_guard<std::mutex> lock(prompt_mutex);
+            out += "> " + prompt_input;
+        }
+    }
+
+    // One event loop for all channels: epoll reports which adapters have
+    // data, each read is stamped and handled before the next one, so the
+    // records of all adapters reach the display and the log in one timeline.
+    // With --read-mode spin epoll_wait() never sleeps, which saves the
+    // wake-up latency at the cost of one busy core.
+    void receive_thread_func()
+    {
+        std::vector<struct epoll_event> events(channels.size() + 1);
+        uint64_t last_expire = 0;
+
+        while (running)
+        {
+            // Wake up regularly while answers are outstanding
+            bool waiting = false;
+            for (size_t c = 0; c < channels.size(); c++)
+            {
+                const Channel &ch = *channels[c];
+                waiting |= ch.tx_pending.size() > 0 || ch.tx_in_flight.load(std::memory_order_relaxed) > 0;
+            }
+            int nev = epoll_wait(epoll_fd, &events[0], (int)events.size(), spin_reads ? 0 : (waiting ? 100 : -1));
+            if (nev < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                perror("epoll_wait");
+                break;
+            }
+            if (waiting)
+            {
+                uint64_t now = monotonic_ns();
+                if (now - last_expire >= 100000000)
+                {
+                    for (size_t c = 0; c < channels.size(); c++)
+                    {
+                        expire_tx_credits(*channels[c], now);
+                    }
+                    last_expire = now;
+                }
+            }
+
+            for (int i = 0; i < nev && running; i++)
+            {
+                // stop_fd is registered without a channel
+                Channel *ch = static_cast<Channel *>(events[i].data.ptr);
+                if (ch && !read_channel(*ch))
+                {
+                    running = false;
+                }
+            }
+        }
+    }
+
+    // Reads what the adapter sent and handles every complete record.
+    // Returns false when the device has gone away.
+    bool read_channel(Channel &ch)
+    {
+        int n = read(ch.fd, ch.rx_framer.write_ptr(), ch.rx_framer.write_space());
+        if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        {
+            return true;
+        }
+        if (n <= 0 && reconnect)
+        {
+            disconnect_channel(ch, n < 0 ? errno : 0);
+            return true;
+        }
+        if (n <= 0)
+        {
+            // VMIN = 0 only returns 0 when the device has gone away
+            std::cout << "\r\033[K" << tag("ERR", ch.index) << " Serial device " << ch.tty_path << " closed";
+            if (n < 0)
+                std::cout << ": " << strerror(errno);
+            std::cout << " - press Enter to exit" << std::endl;
+            return false;
+        }
+
+        uint64_t rx_time = monotonic_ns();
+        ch.rx_framer.commit(n);
+
+        // Process each complete message, a partial one stays buffered
+        SlcanRecord msg;
+        while (ch.rx_framer.next(msg))
+        {
+            handle_record(ch, msg, rx_time);
+        }
+        return true;
+    }
+
+    bool setup_event_loop()
+    {
+        stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (stop_fd < 0)
+        {
+            perror("eventfd");
+            return false;
+        }
+
+        display_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (display_wake_fd < 0)
+        {
+            perror("eventfd");
+            return false;
+        }
+        notices.set_wake_fd(display_wake_fd);
+
+        cyclic_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (cyclic_timer_fd < 0)
+        {
+            perror("timerfd_create");
+            return false;
+        }
+
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0)
+        {
+            perror("epoll_create1");
+            return false;
+        }
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            Channel &ch = *channels[c];
+            ch.tx_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (ch.tx_wake_fd < 0)
+            {
+                perror("eventfd");
+                return false;
+            }
+
+            ev.data.ptr = &ch;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ch.fd, &ev) < 0)
+            {
+                perror("epoll_ctl serial");
+                return false;
+            }
+        }
+
+        ev.data.ptr = nullptr;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &ev) < 0)
+        {
+            perror("epoll_ctl eventfd");
+            return false;
+        }
+        return !reconnect || setup_hotplug();
+    }
+
+    // The /dev/serial/by-id link of a serial port, which keeps its name when
+    // the adapter comes back as another ttyACM, or "" if there is none
+    static std::string by_id_link(const std::string &tty)
+    {
+        static const char BY_ID[] = "/dev/serial/by-id/";
+        if (tty.compare(0, sizeof(BY_ID) - 1, BY_ID) == 0)
+        {
+            return tty;
+        }
+        char real[PATH_MAX], target[PATH_MAX];
+        DIR *dir = opendir(BY_ID);
+        if (!dir || !realpath(tty.c_str(), real))
+        {
+            if (dir)
+                closedir(dir);
+            return "";
+        }
+        std::string link;
+        struct dirent *entry;
+        while (link.empty() && (entry = readdir(dir)) != nullptr)
+        {
+            std::string path = std::string(BY_ID) + entry->d_name;
+            if (entry->d_name[0] != '.' && realpath(path.c_str(), target) && strcmp(target, real) == 0)
+            {
+                link = path;
+            }
+        }
+        closedir(dir);
+        return link;
+    }
+
+    // Watches the directory of every adapter path and its parents, which
+    // udev removes with the last device in them (/dev/serial/by-id)
+    bool setup_hotplug()
+    {
+        hotplug_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        hotplug_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (hotplug_fd < 0 || hotplug_wake_fd < 0)
+        {
+            perror("inotify");
+            return false;
+        }
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            Channel &ch = *channels[c];
+            ch.reopen_path = by_id_link(ch.tty_path);
+            if (ch.reopen_path.empty())
+            {
+                ch.reopen_path = ch.tty_path;
+            }
+            std::cout << tag("INFO", ch.index) << " Reconnecting through " << ch.reopen_path << std::endl;
+
+            std::string dir = ch.reopen_path;
+            size_t slash;
+            while ((slash = dir.find_last_of('/')) != std::string::npos && slash > 0)
+            {
+                dir.erase(slash);
+                if (std::find(hotplug_dirs.begin(), hotplug_dirs.end(), dir) == hotplug_dirs.end())
+                {
+                    hotplug_dirs.push_back(dir);
+                }
+            }
+        }
+        watch_hotplug_dirs();
+        return true;
+    }
+
+    // Adding a watch again is a no-op, so this simply covers directories
+    // that have been created since the last call
+    void watch_hotplug_dirs()
+    {
+        for (size_t i = 0; i < hotplug_dirs.size(); i++)
+        {
+            inotify_add_watch(hotplug_fd, hotplug_dirs[i].c_str(), IN_CREATE | IN_MOVED_TO | IN_ATTRIB | IN_ONLYDIR);
+        }
+    }
+
+    // --reconnect, RX thread: the adapter has gone away. Its descriptor is
+    // pointed at /dev/null, which keeps the number valid for the TX thread
+    // and releases the tty so that the adapter can get its name back.
+    // Outstanding answers are given up.
+    void disconnect_channel(Channel &ch, int error)
+    {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, ch.fd, nullptr);
+        ch.connected.store(false, std::memory_order_release);
+        int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+        if (null_fd >= 0)
+        {
+            dup2(null_fd, ch.fd);
+            close(null_fd);
+        }
+        ch.serial_changed = false;
+        ch.rx_framer.reset();
+        ch.disconnected_ns = monotonic_ns();
+        ch.disconnects.fetch_add(1, std::memory_order_relaxed);
+        expire_tx_credits(ch, UINT64_MAX);
+        wake_tx(ch);
+
+        // Queued behind the records that were read before
+        const char *reason = error ? strerror(error) : "";
+        SlcanRecord msg = {reason, strlen(reason)};
+        display_record(msg, ch.disconnected_ns, ch.index, DisplayItem::GAP);
+        signal_eventfd(hotplug_wake_fd);
+    }
+
+    // Hotplug thread: reopens the adapter, repeats the init commands on it
+    // before the TX thread may write again and hands it back to the RX
+    // thread. Returns false if the path is not usable yet.
+    bool reconnect_channel(Channel &ch)
+    {
+        // Not there yet, or udev has not set the permissions yet
+        int fd = open(ch.reopen_path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct termios tty;
+        if (ioctl(fd, TIOCEXCL) < 0 || tcgetattr(fd, &tty) < 0)
+        {
+            close(fd);
+            return false;
+        }
+        dup2(fd, ch.fd);
+        close(fd);
+        setup_serial_port(ch);
+        ch.adapter_modes = 0;
+
+        uint64_t gap = monotonic_ns() - ch.disconnected_ns;
+        std::ostringstream line;
+        line << tag("GAP", ch.index) << " " << ch.tty_path << " is back after " << gap / 1e9 << " s";
+        notice(line.str());
+        send_init_commands(reconnect_init, ch.index);
+        ch.reconnects++;
+        ch.gap_ns += monotonic_ns() - ch.disconnected_ns;
+
+        ch.connected.store(true, std::memory_order_release);
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = &ch;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ch.fd, &ev) < 0)
+        {
+            perror("epoll_ctl serial");
+        }
+        wake_tx(ch);
+        return true;
+    }
+
+    // Sleeps until something changes in the watched directories or the RX
+    // thread reports a disconnect, then tries to reopen every missing
+    // adapter. Only directory changes matter, not the names in the events.
+    void hotplug_thread_func()
+    {
+        struct pollfd fds[3];
+        fds[0].fd = hotplug_fd;
+        fds[1].fd = hotplug_wake_fd;
+        fds[2].fd = stop_fd;
+        for (int i = 0; i < 3; i++)
+        {
+            fds[i].events = POLLIN;
+        }
+        alignas(struct inotify_event) char events[4096];
+
+        while (running)
+        {
+            if (poll(fds, 3, -1) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                perror("poll");
+                break;
+            }
+            if (fds[2].revents)
+            {
+                break;
+            }
+            while (read(hotplug_fd, events, sizeof(events)) > 0)
+                ;
+            uint64_t value;
+            ssize_t r = read(hotplug_wake_fd, &value, sizeof(value));
+            (void)r;
+
+            watch_hotplug_dirs();
+            for (size_t c = 0; c < channels.size() && running; c++)
+            {
+                if (!channels[c]->connected.load(std::memory_order_acquire))
+                {
+                    reconnect_channel(*channels[c]);
+                }
+            }
+        }
+    }
+
+    void close_event_loop()
+    {
+        if (epoll_fd >= 0)
+        {
+            close(epoll_fd);
+            epoll_fd = -1;
+        }
+        if (stop_fd >= 0)
+        {
+            close(stop_fd);
+            stop_fd = -1;
+        }
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            if (channels[c]->tx_wake_fd >= 0)
+            {
+                close(channels[c]->tx_wake_fd);
+                channels[c]->tx_wake_fd = -1;
+            }
+        }
+        if (display_wake_fd >= 0)
+        {
+            close(display_wake_fd);
+            display_wake_fd = -1;
+        }
+        if (cyclic_timer_fd >= 0)
+        {
+            close(cyclic_timer_fd);
+            cyclic_timer_fd = -1;
+        }
+        if (hotplug_fd >= 0)
+        {
+            close(hotplug_fd);
+            hotplug_fd = -1;
+        }
+        if (hotplug_wake_fd >= 0)
+        {
+            close(hotplug_wake_fd);
+            hotplug_wake_fd = -1;
+        }
+    }
+
+    // True if a command with these flags may be written now
+    bool tx_fits(Channel &ch, uint8_t flags)
+    {
+        if ((flags & TX_FLAG_CREDIT) &&
+            ch.tx_in_flight.load(std::memory_order_acquire) >= (int)ch.tx_window.load(std::memory_order_relaxed))
+        {
+            return false;
+        }
+        return !(flags & TX_FLAG_FEEDBACK) || !ch.tx_pending.full();
+    }
+
+    // Accounts a command that is about to be written: takes its credit,
+    // remembers it until the feedback arrives and stamps its marker.
+    // Returns false if it has to wait.
+    bool tx_admit(Channel &ch, const char *data, uint16_t len, int16_t marker, uint8_t flags, uint8_t retries, uint64_t now)
+    {
+        if (!tx_fits(ch, flags))
+        {
+            return false;
+        }
+        if (flags & TX_FLAG_FEEDBACK)
+        {
+            SentCommand cmd;
+            cmd.sent_ns = now;
+            cmd.len = len;
+            cmd.marker = marker;
+            cmd.flags = flags;
+            cmd.retries = retries;
+            if (flags & TX_FLAG_FRAME)
+            {
+                memcpy(cmd.data, data, len);
+            }
+            ch.tx_pending.push(cmd);
+        }
+        if (flags & TX_FLAG_CREDIT)
+        {
+            ch.tx_in_flight.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (marker >= 0)
+        {
+            stamp_marker(ch, marker, now);
+        }
+        return true;
+    }
+
+    // True if the TX thread has something it may write now
+    bool tx_ready(Channel &ch)
+    {
+        if (!ch.connected.load(std::memory_order_acquire) ||
+            monotonic_ns() < ch.tx_backoff_until.load(std::memory_order_relaxed))
+        {
+            return false;
+        }
+        if (ch.tx_retry.size() > 0)
+        {
+            return tx_fits(ch, ch.tx_retry.peek(0).flags);
+        }
+        const TxQueue::Slot *slot = ch.tx_queue.front();
+        return slot != nullptr && tx_fits(ch, slot->flags);
+    }
+
+    // Moves as many commands as fit into the batch buffer, frames rejected
+    // by the adapter first. Stops at the first command the window holds back.
+    // entries gets one record per command for drop_tx_batch().
+    size_t fill_tx_batch(Channel &ch, std::vector<char> &batch, std::vector<TxBatchEntry> &entries)
+    {
+        size_t len = 0;
+        uint64_t now = monotonic_ns();
+        entries.clear();
+        if (!ch.connected.load(std::memory_order_acquire) || now < ch.tx_backoff_until.load(std::memory_order_relaxed))
+        {
+            return 0;
+        }
+
+        while (ch.tx_retry.size() > 0)
+        {
+            const SentCommand &cmd = ch.tx_retry.peek(0);
+            size_t pending = ch.tx_pending.produced();
+            if (len + cmd.len > batch.size() || !tx_admit(ch, cmd.data, cmd.len, cmd.marker, cmd.flags, cmd.retries, now))
+            {
+                return len;
+            }
+            memcpy(&batch[len], cmd.data, cmd.len);
+            len += cmd.len;
+            TxBatchEntry entry = {len, pending, now, cmd.marker, cmd.flags};
+            entries.push_back(entry);
+            ch.tx_retry.consume(1);
+            ch.tx_retried.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        const TxQueue::Slot *slot;
+        while ((slot = ch.tx_queue.front()) != nullptr && len + slot->len <= batch.size())
+        {
+            size_t pending = ch.tx_pending.produced();
+            if (!tx_admit(ch, slot->data, slot->len, slot->marker, slot->flags, 0, now))
+            {
+                break;
+            }
+            memcpy(&batch[len], slot->data, slot->len);
+            len += slot->len;
+            TxBatchEntry entry = {len, pending, now, slot->marker, slot->flags};
+            entries.push_back(entry);
+            ch.tx_queue.pop();
+            ch.tx_commands.store(ch.tx_commands.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+        return len;
+    }
+
+    // Takes back what tx_admit() did for the commands of the batch that were
+    // not written at all, from offset off on. A partly written command
+    // stays pending, the adapter answers the garbled line.
+    void drop_tx_batch(Channel &ch, const std::vector<TxBatchEntry> &entries, size_t off)
+    {
+        size_t start = 0;
+        for (size_t i = 0; i < entries.size(); start = entries[i].end, i++)
+        {
+            const TxBatchEntry &entry = entries[i];
+            if (start < off)
+                continue;
+
+            // An entry the RX thread already expired has given its credit back
+            bool pending = (entry.flags & TX_FLAG_FEEDBACK) && entry.pending >= ch.tx_pending.consumed();
+            if (pending)
+            {
+                ch.tx_pending_void[entry.pending & (TX_PENDING_SIZE - 1)].store(true, std::memory_order_release);
+            }
+            if (entry.marker >= 0)
+            {
+                uint64_t sent = entry.sent_ns;
+                if (ch.marker_sent_ns[entry.marker].compare_exchange_strong(sent, 0, std::memory_order_relaxed))
+                {
+                    ch.markers_lost.fetch_add(1, std::memory_order_relaxed);
+                    if (entry.flags & TX_FLAG_CREDIT)
+                    {
+                        release_tx_credit(ch, false);
+                    }
+                }
+            }
+            else if (pending && (entry.flags & TX_FLAG_CREDIT))
+            {
+                release_tx_credit(ch, false);
+            }
+        }
+    }
+
+    void transmit_thread_func(Channel *channel)
+    {
+        Channel &ch = *channel;
+        std::vector<char> batch(TX_BATCH_SIZE);
+        std::vector<TxBatchEntry> entries;
+        size_t batch_len = 0;
+        size_t batch_off = 0;
+
+        // Private epoll set: the wake-up eventfd always, the serial port only
+        // while a write is blocked by EAGAIN
+        int tx_epoll = epoll_create1(EPOLL_CLOEXEC);
+        if (tx_epoll < 0)
+        {
+            perror("epoll_create1");
+            return;
+        }
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = ch.tx_wake_fd;
+        epoll_ctl(tx_epoll, EPOLL_CTL_ADD, ch.tx_wake_fd, &ev);
+        bool wait_writable = false;
+
+        for (;;)
+        {
+            if (batch_off == batch_len)
+            {
+                batch_off = 0;
+                batch_len = fill_tx_batch(ch, batch, entries);
+            }
+
+            if (batch_len == 0)
+            {
+                if (!running)
+                    break;
+
+                // Sleep until a command is pushed, a credit is returned or
+                // the back-off is over
+                int timeout = -1;
+                uint64_t backoff_until = ch.tx_backoff_until.load(std::memory_order_relaxed);
+                uint64_t now = monotonic_ns();
+                if (now < backoff_until)
+                {
+                    timeout = (backoff_until - now) / 1000000 + 1;
+                }
+
+                // Announce the sleep, then check once more so that a command
+                // pushed in between is not missed
+                ch.tx_idle.store(true);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (!tx_ready(ch) && running)
+                {
+                    struct epoll_event events[2];
+                    int nev = epoll_wait(tx_epoll, events, 2, timeout);
+                    if (nev < 0 && errno != EINTR)
+                    {
+                        perror("epoll_wait");
+                        break;
+                    }
+                    uint64_t value;
+                    ssize_t r = read(ch.tx_wake_fd, &value, sizeof(value));
+                    (void)r;
+                }
+                ch.tx_idle.store(false);
+                continue;
+            }
+
+            // One write() for everything that was pending
+            ssize_t n = write(ch.fd, &batch[batch_off], batch_len - batch_off);
+            if (n > 0)
+            {
+                ch.tx_writes++;
+                batch_off += n;
+                if (batch_off < batch_len)
+                {
+                    ch.tx_partial_writes++;
+                }
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n < 0 && errno != EAGAIN)
+            {
+                notice(tag("ERR", ch.index) + " write: " + strerror(errno) + " - " +
+                       std::to_string(batch_len - batch_off) + " bytes dropped");
+                drop_tx_batch(ch, entries, batch_off);
+                batch_off = batch_len;
+                continue;
+            }
+
+            // Driver buffer is full: wait until the port is writable again.
+            // While shutting down give up after one second.
+            ch.tx_eagain++;
+            if (!wait_writable)
+            {
+                ev.events = EPOLLOUT;
+                ev.data.fd = ch.fd;
+                epoll_ctl(tx_epoll, EPOLL_CTL_ADD, ch.fd, &ev);
+                wait_writable = true;
+            }
+            struct epoll_event events[2];
+            int nev = epoll_wait(tx_epoll, events, 2, running ? -1 : 1000);
+            if (nev == 0)
+            {
+                notice(tag("ERR", ch.index) + " write timeout - " + std::to_string(batch_len - batch_off) +
+                       " bytes dropped");
+                drop_tx_batch(ch, entries, batch_off);
+                break;
+            }
+            for (int i = 0; i < nev; i++)
+            {
+                if (events[i].data.fd == ch.tx_wake_fd)
+                {
+                    uint64_t value;
+                    ssize_t r = read(ch.tx_wake_fd, &value, sizeof(value));
+                    (void)r;
+                }
+                else if (events[i].data.fd == ch.fd)
+                {
+                    epoll_ctl(tx_epoll, EPOLL_CTL_DEL, ch.fd, nullptr);
+                    wait_writable = false;
+                }
+            }
+            if (wait_writable && !ch.connected.load(std::memory_order_acquire))
+            {
+                // The registration went with the old device
+                epoll_ctl(tx_epoll, EPOLL_CTL_DEL, ch.fd, nullptr);
+                wait_writable = false;
+            }
+        }
+
+        close(tx_epoll);
+    }
+
+    // Adapter modes after the command: M<modes> switches modes on (upper
+    // case) and off (lower case), C resets the adapter to its defaults
+    static unsigned apply_mode_command(unsigned modes, const char *data, size_t len)
+    {
+        if (len > 0 && data[len - 1] == '\r')
+        {
+            len--;
+        }
+        if (len == 1 && data[0] == 'C')
+        {
+            return 0;
+        }
+        if (len < 2 || data[0] != 'M')
+        {
+            return modes;
+        }
+        for (size_t i = 1; i < len; i++)
+        {
+            switch (data[i])
+            {
+            case 'F':
+                modes |= MODE_FEEDBACK;
+                break;
+            case 'f':
+                modes &= ~MODE_FEEDBACK;
+                break;
+            case 'M':
+                modes |= MODE_MARKERS;
+                break;
+            case 'm':
+                modes &= ~MODE_MARKERS;
+                break;
+            }
+        }
+        return modes;
+    }
+
+    // TxFlags of an encoded command. modes holds the modes after the
+    // command: the adapter answers MF itself (info/slcan25.md, "This will
+    // be the first command that sends a feedback"), but not Mf or C.
+    uint8_t tx_command_flags(Channel &ch, const char *data, size_t len, unsigned modes, int marker)
+    {
+        uint8_t flags = 0;
+        if (modes & MODE_FEEDBACK)
+        {
+            flags |= TX_FLAG_FEEDBACK;
+        }
+        if (len > 0 && memchr("tTrRdDbB", data[0], 8))
+        {
+            flags |= TX_FLAG_FRAME;
+            if (ch.tx_window_max > 0 && (marker >= 0 || (flags & TX_FLAG_FEEDBACK)))
+            {
+                flags |= TX_FLAG_CREDIT;
+            }
+        }
+        return flags;
+    }
+
+    // Appends the next rolling marker to the frame command (incl. \r) in
+    // buf, which must have room for two more characters. A frame that
+    // already carries a marker keeps it. Returns the marker or -1.
+    int attach_marker(Channel &ch, char *buf, size_t &len)
+    {
+        if (len < 2 || buf[len - 1] != '\r')
+        {
+            return -1;
+        }
+        size_t frame_len = slcan_tx_frame_len(buf, len - 1);
+        if (frame_len == 0)
+        {
+            return -1;
+        }
+
+        if (len - 1 == frame_len)
+        {
+            int marker = ch.next_marker.fetch_add(1, std::memory_order_relaxed) & (MARKER_COUNT - 1);
+            buf[frame_len] = hex_upper[marker >> 4];
+            buf[frame_len + 1] = hex_upper[marker & 0x0F];
+            buf[frame_len + 2] = '\r';
+            len += 2;
+            return marker;
+        }
+        if (len - 1 == frame_len + 2)
+        {
+            uint8_t hi = hex_table.value[(uint8_t)buf[frame_len]];
+            uint8_t lo = hex_table.value[(uint8_t)buf[frame_len + 1]];
+            if (!((hi | lo) & 0xF0))
+            {
+                return (hi << 4) | lo;
+            }
+        }
+        return -1;
+    }
+
+    // Called right before a marked frame is written. A marker that is still
+    // pending was never echoed.
+    void stamp_marker(Channel &ch, int marker, uint64_t now)
+    {
+        ch.markers_sent.fetch_add(1, std::memory_order_relaxed);
+        if (ch.marker_sent_ns[marker].exchange(now, std::memory_order_relaxed) != 0)
+        {
+            ch.markers_lost.fetch_add(1, std::memory_order_relaxed);
+            if (ch.tx_window_max > 0)
+            {
+                release_tx_credit(ch, false);
+            }
+        }
+    }
+
+    // Queues one encoded command (incl. \r) for the TX thread.
+    // Returns false if the queue is full. With wake = false the caller
+    // queues more and calls wake_tx() after the last one.
+    bool enqueue_tx(Channel &ch, const char *data, size_t len, bool wake = true)
+    {
+        unsigned modes = ch.adapter_modes.load(std::memory_order_relaxed);
+        unsigned new_modes = apply_mode_command(modes, data, len);
+
+        char buf[TxQueue::SLOT_SIZE];
+        int marker = -1;
+        if ((modes & MODE_MARKERS) && len + 2 <= sizeof(buf))
+        {
+            memcpy(buf, data, len);
+            marker = attach_marker(ch, buf, len);
+            data = buf;
+        }
+
+        if (!ch.tx_queue.push(data, len, marker, tx_command_flags(ch, data, len, new_modes, marker)))
+        {
+            return false;
+        }
+        if (new_modes != modes)
+        {
+            ch.adapter_modes.store(new_modes, std::memory_order_relaxed);
+        }
+        ch.tx_enqueued.fetch_add(1, std::memory_order_relaxed);
+        if (wake)
+        {
+            wake_tx(ch);
+        }
+        return true;
+    }
+
+    // Starts or stops one cyclic message. The timer runs while at least one
+    // message does. Called with cyclic_mutex held.
+    void run_cyclic(size_t index, bool run)
+    {
+        CyclicMessage &m = cyclic_messages[index];
+        if (m.running == run)
+        {
+            return;
+        }
+        m.running = run;
+        if (run)
+        {
+            m.next_tick = cyclic_wheel.current() + 1;
+            m.last_ns = 0;
+            cyclic_wheel.schedule((int)index, m.next_tick);
+            cyclic_running++;
+        }
+        else
+        {
+            cyclic_wheel.cancel((int)index);
+            cyclic_running--;
+        }
+
+        if (cyclic_running == (run ? 1u : 0u))
+        {
+            struct itimerspec spec;
+            memset(&spec, 0, sizeof(spec));
+            if (run)
+            {
+                spec.it_value.tv_nsec = CYCLIC_TICK_NS;
+                spec.it_interval.tv_nsec = CYCLIC_TICK_NS;
+            }
+            if (timerfd_settime(cyclic_timer_fd, 0, &spec, nullptr) < 0)
+            {
+                perror("timerfd_settime");
+            }
+        }
+    }
+
+    // Queues one cyclic message without waking the TX threads, marks the
+    // channels in woken and bumps its counter. Called with cyclic_mutex held.
+    void send_cyclic(CyclicMessage &m, uint64_t now, std::vector<char> &woken)
+    {
+        bool queued = false;
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            if (m.channel >= 0 && m.channel != (int)c)
+                continue;
+            if (enqueue_tx(*channels[c], m.command.c_str(), m.command.length(), false))
+            {
+                woken[c] = 1;
+                queued = true;
+            }
+            else
+            {
+                m.queue_full++;
+            }
+        }
+        if (!queued)
+        {
+            return;
+        }
+
+        m.sent++;
+        if (m.last_ns)
+        {
+            int64_t jitter = (int64_t)(now - m.last_ns) - (int64_t)(m.period_ticks * CYCLIC_TICK_NS);
+            if (m.intervals == 0 || jitter < m.jitter_min_ns)
+                m.jitter_min_ns = jitter;
+            if (m.intervals == 0 || jitter > m.jitter_max_ns)
+                m.jitter_max_ns = jitter;
+            m.jitter_abs_ns += jitter < 0 ? -jitter : jitter;
+            m.intervals++;
+        }
+        m.last_ns = now;
+
+        if (m.counter_pos >= 0)
+        {
+            char *digits = &m.command[m.counter_pos];
+            uint8_t value = (uint8_t)((hex_table.value[(uint8_t)digits[0]] << 4) | hex_table.value[(uint8_t)digits[1]]);
+            uint8_t step = m.counter_mask & (uint8_t)-m.counter_mask; // Lowest counter bit
+            value = (uint8_t)((value & ~m.counter_mask) | ((value + step) & m.counter_mask));
+            digits[0] = hex_upper[value >> 4];
+            digits[1] = hex_upper[value & 0x0F];
+        }
+    }
+
+    // Advances the timer wheel by the ticks that passed since the last
+    // wake-up, so a late wake-up does not shift the schedule. A message due
+    // several times in one wake-up is sent once, the rest count as overruns.
+    void cyclic_thread_func()
+    {
+        struct pollfd fds[2];
+        fds[0].fd = cyclic_timer_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = stop_fd;
+        fds[1].events = POLLIN;
+        std::vector<int> due;
+        std::vector<char> woken(channels.size(), 0);
+
+        while (running)
+        {
+            if (poll(fds, 2, -1) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                perror("poll");
+                break;
+            }
+            if (fds[1].revents)
+            {
+                break;
+            }
+            uint64_t ticks;
+            if (read(cyclic_timer_fd, &ticks, sizeof(ticks)) != (ssize_t)sizeof(ticks))
+            {
+                continue;
+            }
+
+            uint64_t now = monotonic_ns();
+            std::lock_guard<std::mutex> lock(cyclic_mutex);
+            cyclic_batches++;
+            for (uint64_t t = 0; t < ticks; t++)
+            {
+                due.clear();
+                cyclic_wheel.advance(due);
+                for (size_t i = 0; i < due.size(); i++)
+                {
+                    CyclicMessage &m = cyclic_messages[due[i]];
+                    if (m.last_batch == cyclic_batches)
+                    {
+                        m.overruns++;
+                    }
+                    else
+                    {
+                        m.last_batch = cyclic_batches;
+                        send_cyclic(m, now, woken);
+                    }
+                    m.next_tick += m.period_ticks;
+                    cyclic_wheel.schedule(due[i], m.next_tick);
+                }
+            }
+
+            // All frames of this wake-up are queued, now let the TX threads write them
+            for (size_t c = 0; c < channels.size(); c++)
+            {
+                if (woken[c])
+                {
+                    woken[c] = 0;
+                    wake_tx(*channels[c]);
+                }
+            }
+        }
+    }
+
+    // cyclic add <period> [<n>:]<frame> [counter=<byte>[/<mask>]]
+    void add_cyclic(std::istringstream &in)
+    {
+        std::string period_text, frame_text, option;
+        if (!(in >> period_text >> frame_text))
+        {
+            std::cerr << "Error: Usage: cyclic add <period> [<n>:]<frame> [counter=<byte>[/<mask>]]" << std::endl;
+            return;
+        }
+
+        uint64_t period_ns;
+        if (!parse_delay(period_text.c_str(), period_text.length(), period_ns) || period_ns > CYCLIC_MAX_PERIOD_NS)
+        {
+            std::cerr << "Error: Invalid period: " << period_text << std::endl;
+            return;
+        }
+        uint64_t period_ticks = (period_ns + CYCLIC_TICK_NS / 2) / CYCLIC_TICK_NS;
+        if (period_ticks == 0)
+        {
+            std::cerr << "Error: The shortest period is " << CYCLIC_TICK_NS / 1000000 << " ms" << std::endl;
+            return;
+        }
+
+        std::string frame = frame_text;
+        int channel;
+        if (!split_channel(frame, channel))
+        {
+            return;
+        }
+        char encoded[SLCAN_MAX_COMMAND];
+        size_t len = encode_command(frame.c_str(), frame.length(), encoded);
+        std::string command(encoded, len);
+        size_t frame_len = len > 0 ? slcan_tx_frame_len(encoded, len - 1) : 0;
+        if (frame_len == 0 || frame_len != len - 1)
+        {
+            std::cerr << "Error: Cyclic messages must be data frames with DLC matching the data: " << frame_text
+                      << std::endl;
+            return;
+        }
+
+        int counter_pos = -1;
+        unsigned counter_mask = 0;
+        std::string text = frame_text;
+        while (in >> option)
+        {
+            unsigned byte;
+            int used = 0;
+            counter_mask = 0xFF;
+            size_t data_pos = (command[0] >= 'a' ? 3 : 8) + 2;
+            if (option.compare(0, 8, "counter=") != 0 ||
+                sscanf(option.c_str() + 8, "%u%n/%x%n", &byte, &used, &counter_mask, &used) < 1 ||
+                option[8 + used] != '\0' || counter_mask == 0 || counter_mask > 0xFF ||
+                data_pos + 2 * byte + 2 > frame_len)
+            {
+                std::cerr << "Error: Invalid option (counter=<byte>[/<hex mask>] within the data): " << option
+                          << std::endl;
+                return;
+            }
+            counter_pos = (int)(data_pos + 2 * byte);
+            text += " " + option;
+        }
+
+        std::lock_guard<std::mutex> lock(cyclic_mutex);
+        size_t index = 0;
+        while (index < cyclic_messages.size() && cyclic_messages[index].used)
+        {
+            index++;
+        }
+        if (index == cyclic_messages.size())
+        {
+            cyclic_messages.push_back(CyclicMessage());
+        }
+
+        CyclicMessage &m = cyclic_messages[index];
+        m = CyclicMessage(); // Zeroes the counters
+        m.used = true;
+        m.channel = channel;
+        m.period_ticks = period_ticks;
+        m.text = text;
+        m.command = command;
+        m.counter_pos = counter_pos;
+        m.counter_mask = (uint8_t)counter_mask;
+        run_cyclic(index, true);
+
+        std::cout << "[CYCLIC] #" << index + 1 << " every " << period_ticks * CYCLIC_TICK_NS / 1e6 << " ms: " << text
+                  << std::endl;
+    }
+
+public:
+    static const size_t MAX_CHANNELS = 16;
+
+    explicit SlcanTerminal(const std::vector<std::string> &ttys)
+        : epoll_fd(-1), stop_fd(-1), reconnect(false), hotplug_fd(-1), hotplug_wake_fd(-1), display_wake_fd(-1),
+          running(false), tx_active(false),
+          display_queue(DISPLAY_QUEUE_SIZE), display_dropped(0), display_idle(false), display_active(false),
+          interactive(false), low_latency(false), spin_reads(false), timestamp_mode(0), wall_offset_ns(0),
+          start_ns(0), frames_filtered(0), cyclic_timer_fd(-1), cyclic_running(0), cyclic_batches(0),
+          stats_enabled(false)
+    {
+        for (size_t i = 0; i < ttys.size(); i++)
+        {
+            channels.push_back(std::unique_ptr<Channel>(new Channel((int)i, ttys[i], 64)));
+        }
+    }
+
+    ~SlcanTerminal()
+    {
+        if (running)
+        {
+            stop();
+        }
+        close_event_loop();
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            Channel &ch = *channels[c];
+            if (ch.fd >= 0)
+            {
+                restore_serial(ch);
+                close(ch.fd);
+            }
+        }
+    }
+
+    size_t channel_count() const
+    {
+        return channels.size();
+    }
+
+    // Opens all adapters, fails if one of them cannot be opened
+    bool open_devices()
+    {
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            if (!open_device(*channels[c]))
+            {
+                std::cerr << "Failed to open device: " << channels[c]->tty_path << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool open_device(Channel &ch)
+    {
+        const std::string &tty_path = ch.tty_path;
+
+        // Check if the path exists and resolve symlinks
+        struct stat st;
+        if (stat(tty_path.c_str(), &st) < 0)
+        {
+            perror(tty_path.c_str());
+            return false;
+        }
+
+        // Check if it's a character device
+        if (!S_ISCHR(st.st_mode))
+        {
+            std::cerr << "Error: " << tty_path << " is not a character device" << std::endl;
+            return false;
+        }
+
+        // Open the device, non-blocking so that a full driver buffer shows up
+        // as EAGAIN in the TX thread instead of stalling it
+        ch.fd = open(tty_path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if (ch.fd < 0)
+        {
+            perror(tty_path.c_str());
+            return false;
+        }
+
+        // Try to get exclusive access to the serial port
+        // This will fail if the port is already in use
+        if (ioctl(ch.fd, TIOCEXCL) < 0)
+        {
+            perror("Cannot get exclusive access (port already in use?)");
+            close(ch.fd);
+            ch.fd = -1;
+            return false;
+        }
+
+        // Try to configure as serial port - this will fail if it's not a TTY
+        struct termios tty;
+        if (tcgetattr(ch.fd, &tty) < 0)
+        {
+            std::cerr << "Error: " << tty_path << " - cannot get terminal attributes (not a TTY?)" << std::endl;
+            close(ch.fd);
+            ch.fd = -1;
+            return false;
+        }
+
+        setup_serial_port(ch);
+        return true;
+    }
+
+    // Encodes a command with its \r into out (SLCAN_MAX_COMMAND bytes),
+    // converting cansend syntax. Returns the length, or 0 for invalid input.
+    size_t encode_command(const char *cmd, size_t len, char *out)
+    {
+        int n = encode_cansend(cmd, len, out);
+        if (n != 0)
+        {
+            return n < 0 ? 0 : n;
+        }
+
+        // Already SLCAN, add the carriage return if not present
+        if (len > 0 && cmd[len - 1] == '\r')
+        {
+            len--;
+        }
+        if (len >= SLCAN_MAX_COMMAND)
+        {
+            std::cerr << "Error: Command too long: " << std::string(cmd, len) << std::endl;
+            return 0;
+        }
+        memcpy(out, cmd, len);
+        out[len++] = '\r';
+        return len;
+    }
+
+    // Writes a command directly from the calling thread, used while the TX
+    // thread is not running
+    void write_command(Channel &ch, const std::string &cmd)
+    {
+        char command[SLCAN_MAX_COMMAND];
+        size_t len = encode_command(cmd.c_str(), cmd.length(), command);
+        if (len == 0)
+        {
+            return;
+        }
+        if (!write_all(ch.fd, command, len))
+        {
+            perror("write");
+            return;
+        }
+        ch.adapter_modes = apply_mode_command(ch.adapter_modes, command, len);
+    }
+
+    // Splits an optional "<n>:" channel prefix off a command, channel is -1
+    // (all channels) without one. Returns false for a channel that does not
+    // exist. SLCAN commands never start with a digit.
+    bool split_channel(const char *&cmd, const char *end, int &channel)
+    {
+        channel = -1;
+        const char *colon = cmd;
+        unsigned long n = 0;
+        while (colon < end && *colon >= '0' && *colon <= '9')
+        {
+            n = n * 10 + (*colon++ - '0');
+        }
+        if (colon == cmd || colon == end || *colon != ':')
+        {
+            return true;
+        }
+        if (colon - cmd > 9 || n >= channels.size())
+        {
+            std::cerr << "Error: No channel " << std::string(cmd, colon) << ", channels are 0-" << channels.size() - 1
+                      << std::endl;
+            return false;
+        }
+        channel = (int)n;
+        cmd = colon + 1;
+        return true;
+    }
+
+    bool split_channel(std::string &cmd, int &channel)
+    {
+        const char *first = cmd.c_str();
+        if (!split_channel(first, first + cmd.length(), channel))
+        {
+            return false;
+        }
+        cmd.erase(0, first - cmd.c_str());
+        return true;
+    }
+
+    // Shows a per-ID statistics table instead of every received frame
+    void enable_stats()
+    {
+        stats_enabled = true;
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            channels[c]->id_stats.reset(new IdStatsTable());
+        }
+    }
+
+    // Shows one row per ID with the latest data instead of every frame
+    void enable_sniff()
+    {
+        enable_stats();
+        sniff_view.reset(new SniffView());
+    }
+
+    // Only frames accepted by the filter are logged, counted and shown
+    void set_filter(std::unique_ptr<FrameFilter> filter)
+    {
+        frame_filter = std::move(filter);
+    }
+
+    // Reopen adapters that go away and send them init_commands again
+    void set_reconnect(const std::vector<std::string> &init_commands)
+    {
+        reconnect = true;
+        reconnect_init = init_commands;
+    }
+
+    // Set before open_devices()
+    void set_low_latency(bool on)
+    {
+        low_latency = on;
+    }
+
+    void set_spin_reads(bool on)
+    {
+        spin_reads = on;
+    }
+
+    // a = absolute, z = since start, d = since the previous record
+    void set_timestamp_mode(char mode)
+    {
+        timestamp_mode = mode;
+    }
+
+    // Maximum number of frames in flight, 0 disables flow control
+    void set_tx_window(unsigned frames)
+    {
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            channels[c]->tx_window_max = frames;
+            channels[c]->tx_window = frames;
+        }
+    }
+
+    // Waits until every queued command is written and every frame in
+    // flight is answered
+    void wait_tx_drain()
+    {
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            const Channel &ch = *channels[c];
+            while (running &&
+                   (ch.tx_commands.load(std::memory_order_acquire) != ch.tx_enqueued.load(std::memory_order_relaxed) ||
+                    ch.tx_in_flight.load(std::memory_order_relaxed) > 0 || ch.tx_retry.size() > 0))
+            {
+                usleep(1000);
+            }
+        }
+    }
+
+    // Like enqueue_tx() but waits for free space instead of failing.
+    // Returns false only if the terminal is stopped while waiting.
+    bool enqueue_tx_wait(Channel &ch, const char *data, size_t len)
+    {
+        while (!enqueue_tx(ch, data, len))
+        {
+            if (!running)
+            {
+                return false;
+            }
+            usleep(100);
+        }
+        return true;
+    }
+
+    // Hands a command to the TX thread of its channel, or of every channel
+    // without a prefix. The write happens asynchronously.
+    void send_command(const std::string &input, bool show_output = true)
+    {
+        std::string cmd = input;
+        int channel;
+        if (!split_channel(cmd, channel))
+        {
+            return;
+        }
+
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            if (channel >= 0 && (int)c != channel)
+                continue;
+            Channel &ch = *channels[c];
+            if (!tx_active)
+            {
+                write_command(ch, cmd);
+                continue;
+            }
+
+            char command[SLCAN_MAX_COMMAND];
+            size_t len = encode_command(cmd.c_str(), cmd.length(), command);
+            if (len == 0)
+            {
+                return;
+            }
+            if (!enqueue_tx(ch, command, len))
+            {
+                std::cerr << "Error: TX queue full, command dropped" << std::endl;
+            }
+            else if (show_output)
+            {
+                std::cout << tag("TX", ch.index) << " ";
+                std::cout.write(command, len) << std::endl;
+            }
+        }
+    }
+
+    // Prints the responses to the init command cmd until every channel in
+    // awaiting has answered with feedback or text, or until the deadline if
+    // none is awaited. Reads all channels, or only one if only_channel >= 0.
+    // Returns the number of failed and unanswered commands.
+    unsigned read_init_responses(const std::string &cmd, std::vector<bool> &awaiting, uint64_t deadline,
+                                 int only_channel)
+    {
+        size_t remaining = std::count(awaiting.begin(), awaiting.end(), true);
+        bool fixed_delay = (remaining == 0);
+        unsigned failed = 0;
+
+        // Channels that are not read get a negative fd, which poll() skips
+        std::vector<struct pollfd> fds(channels.size());
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            fds[c].fd = (only_channel < 0 || (int)c == only_channel) ? channels[c]->fd : -1;
+            fds[c].events = POLLIN;
+            fds[c].revents = 0;
+        }
+
+        while (fixed_delay || remaining > 0)
+        {
+            uint64_t now = monotonic_ns();
+            if (now >= deadline)
+            {
+                break;
+            }
+            int ready = poll(fds.data(), fds.size(), (int)((deadline - now + 999999) / 1000000));
+            if (ready < 0 && errno != EINTR)
+            {
+                perror("poll");
+                break;
+            }
+
+            for (size_t c = 0; c < channels.size() && ready > 0; c++)
+            {
+                if (!(fds[c].revents & POLLIN))
+                {
+                    continue;
+                }
+                Channel &ch = *channels[c];
+                int n = read(ch.fd, ch.rx_framer.write_ptr(), ch.rx_framer.write_space());
+                if (n <= 0)
+                {
+                    continue;
+                }
+                ch.rx_framer.commit(n);
+
+                // Process each complete message, a partial one stays buffered
+                SlcanRecord msg;
+                while (ch.rx_framer.next(msg))
+                {
+                    std::string description = get_record_description(msg);
+                    notice(tag("RESP", ch.index) + " " + std::string(msg.data, msg.len) + description);
+
+                    // Feedback or a text response (+...) ends the command's
+                    // responses, feedback other than a lone # is an error
+                    if (msg.data[0] != '#' && msg.data[0] != '+')
+                    {
+                        continue;
+                    }
+                    if (msg.data[0] == '#' && msg.len > 1)
+                    {
+                        std::string error = "Error: " + cmd + " failed";
+                        if (channels.size() > 1)
+                        {
+                            error += " on channel " + std::to_string(ch.index);
+                        }
+                        notice(error + description, true);
+                        failed++;
+                    }
+                    if (awaiting[c])
+                    {
+                        awaiting[c] = false;
+                        remaining--;
+                    }
+                }
+            }
+        }
+
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            if (awaiting[c])
+            {
+                std::string error = "Error: No feedback to " + cmd;
+                if (channels.size() > 1)
+                {
+                    error += " on channel " + std::to_string(c);
+                }
+                notice(error + " within " + std::to_string(INIT_FEEDBACK_TIMEOUT_NS / 1000000) + " ms", true);
+                failed++;
+            }
+        }
+        return failed;
+    }
+
+    // Sends the init commands to all channels, or after a reconnect only to
+    // only_channel. The output goes through notice(), a reconnect runs
+    // while the display thread owns the console.
+    void send_init_commands(const std::vector<std::string> &commands, int only_channel = -1)
+    {
+        if (commands.empty())
+        {
+            return;
+        }
+
+        // Blank lines around the block only at startup, not in the dashboards
+        std::string blank = only_channel < 0 ? "\n" : "";
+        notice(blank + "=== Sending initialization commands ===");
+
+        uint64_t start_ns = monotonic_ns();
+        unsigned failed = 0;
+        for (const auto &input : commands)
+        {
+            std::string cmd = input;
+            int channel;
+            if (!split_channel(cmd, channel))
+            {
+                continue;
+            }
+            if (only_channel >= 0)
+            {
+                if (channel >= 0 && channel != only_channel)
+                    continue;
+                channel = only_channel;
+            }
+            notice("[INIT] " + input);
+
+            // The modes after the command tell whether the adapter answers
+            // it: MF is the first command with feedback, Mf and C have none
+            std::vector<bool> awaiting(channels.size(), false);
+            bool feedback = false;
+            for (size_t c = 0; c < channels.size(); c++)
+            {
+                if (channel < 0 || (int)c == channel)
+                {
+                    write_command(*channels[c], cmd);
+                    awaiting[c] = (channels[c]->adapter_modes & MODE_FEEDBACK) != 0;
+                    feedback = feedback || awaiting[c];
+                }
+            }
+
+            // C never answers, not even on legacy firmware, so there is
+            // nothing to wait for
+            if (!feedback && cmd == "C")
+            {
+                continue;
+            }
+            failed += read_init_responses(input, awaiting,
+                                          monotonic_ns() + (feedback ? INIT_FEEDBACK_TIMEOUT_NS : INIT_FALLBACK_DELAY_NS),
+                                          only_channel);
+        }
+
+        std::string done =
+            "=== Initialization complete in " + std::to_string((monotonic_ns() - start_ns) / 1000000) + " ms";
+        if (failed > 0)
         {
-            tcsetattr(fd, TCSANOW, &old_tty_settings);
+            done += ", " + std::to_string(failed) + (failed == 1 ? " error" : " errors");
         }
+        notice(done + " ===" + blank);
     }
 
-    std::string get_feedback_description(const std::string &response)
+    bool start_io()
     {
-        // Check if response contains feedback code (starts with #)
-        size_t pos = response.find('#');
-        if (pos == std::string::npos)
+        if (!setup_event_loop())
         {
-            return "";
+            return false;
         }
 
-        // Extract the character after #
-        if (pos + 1 < response.length())
-        {
-            char code = response[pos + 1];
+        struct timespec real;
+        clock_gettime(CLOCK_REALTIME, &real);
+        start_ns = monotonic_ns();
+        wall_offset_ns = (int64_t)((uint64_t)real.tv_sec * 1000000000ull + real.tv_nsec) - (int64_t)start_ns;
 
-            switch (code)
-            {
-            case '\r':
-            case '\n':
-                return " (Success)";
-            case '1':
-                return " (Invalid command)";
-            case '2':
-                return " (Invalid parameter)";
-            case '3':
-                return " (Adapter must be open)";
-            case '4':
-                return " (Adapter must be closed)";
-            case '5':
-                return " (HAL error from ST Microelectronics)";
-            case '6':
-                return " (Feature not supported/implemented)";
-            case '7':
-                return " (CAN Tx buffer full - no ACK, 67 packets waiting)";
-            case '8':
-                return " (CAN bus off - severe error occurred)";
-            case '9':
-                return " (Sending not possible in silent mode)";
-            case ':':
-                return " (Baudrate not set)";
-            case ';':
-                return " (Flash Option Bytes programming failed)";
-            case '<':
-                return " (Hardware reset required - reconnect USB)";
-            default:
-                return "";
-            }
-        }
+        running = true;
 
-        return "";
+        // Start display and receiver threads and one transmitter per adapter
+        display_active = true;
+        display_thread = std::thread(stats_enabled ? &SlcanTerminal::stats_thread_func : &SlcanTerminal::display_thread_func, this);
+        rx_thread = std::thread(&SlcanTerminal::receive_thread_func, this);
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            channels[c]->tx_thread = std::thread(&SlcanTerminal::transmit_thread_func, this, channels[c].get());
+        }
+        cyclic_thread = std::thread(&SlcanTerminal::cyclic_thread_func, this);
+        if (reconnect)
+        {
+            hotplug_thread = std::thread(&SlcanTerminal::hotplug_thread_func, this);
+        }
+        tx_active = true;
+        return true;
     }
 
-    std::string get_error_description(const std::string &response)
+    void stop_io()
     {
-        // Check if response is an error report (format: Exxxxxxxx)
-        size_t pos = response.find('E');
-        if (pos == std::string::npos)
+        stop();
+
+        // Wait for receiver thread to finish
+        rx_thread.join();
+        cyclic_thread.join();
+        if (hotplug_thread.joinable())
         {
-            return "";
+            hotplug_thread.join();
         }
 
-        // Error format: Exxxxxxxx (9 characters total: E + 8 hex digits)
-        if (pos + 8 >= response.length())
+        // The TX threads flush what is still queued before they exit
+        for (size_t c = 0; c < channels.size(); c++)
         {
-            return "";
+            channels[c]->tx_thread.join();
         }
+        tx_active = false;
 
-        std::string error_code = response.substr(pos + 1, 8);
+        // Show the rest of the received records
+        display_active = false;
+        signal_eventfd(display_wake_fd);
+        display_thread.join();
 
-        // Validate it's all hex digits
-        for (char c : error_code)
+        if (capture_log)
         {
-            if (!std::isxdigit(c))
-            {
-                return "";
-            }
+            capture_log->close();
         }
-
-        std::string desc = " (";
-
-        // Digit 1: Bus Status
-        char bus_status = error_code[0];
-        switch (bus_status)
+        if (trigger)
         {
-        case '0':
-            desc += "Bus Active";
-            break;
-        case '1':
-            desc += "Warning Level";
-            break;
-        case '2':
-            desc += "Bus Passive";
-            break;
-        case '3':
-            desc += "Bus Off";
-            break;
-        default:
-            desc += "Unknown Bus Status";
+            trigger->close();
         }
-
-        // Digit 2: Last Protocol Error
-        char protocol_error = error_code[1];
-        if (protocol_error != '0')
+        if (shm_ring)
         {
-            desc += ", ";
-            switch (protocol_error)
-            {
-            case '1':
-                desc += "Bit stuffing error";
-                break;
-            case '2':
-                desc += "Frame format error";
-                break;
-            case '3':
-                desc += "No ACK received";
-                break;
-            case '4':
-                desc += "Recessive bit error";
-                break;
-            case '5':
-                desc += "Dominant bit error";
-                break;
-            case '6':
-                desc += "CRC error";
-                break;
-            default:
-                desc += "Unknown protocol error";
-            }
+            shm_ring->close();
         }
+        // The writers may signal display_wake_fd until they are joined
+        close_event_loop();
 
-        // Digits 3+4: Firmware Error Flags (hex)
-        std::string fw_flags = error_code.substr(2, 2);
-        int flags = std::stoi(fw_flags, nullptr, 16);
+        // Lines posted after the display thread stopped
+        std::deque<std::string> lines;
+        notices.take(lines);
+        for (size_t i = 0; i < lines.size(); i++)
+        {
+            std::cout << lines[i] << std::endl;
+        }
 
-        if (flags != 0)
+        for (size_t c = 0; c < channels.size(); c++)
         {
-            desc += ", ";
-            bool first = true;
-            if (flags & 0x01)
-            {
-                desc += "Rx Failed";
-                first = false;
-            }
-            if (flags & 0x02)
+            const Channel &ch = *channels[c];
+            std::string prefix = channels.size() > 1 ? tag("", ch.index) + " " : "";
+            if (ch.tx_commands > 0)
             {
-                if (!first)
-                    desc += "+";
-                desc += "Tx Failed";
-                first = false;
+                std::cout << (c ? "" : "\n") << prefix << "TX: " << ch.tx_commands << " commands in " << ch.tx_writes
+                          << " writes (" << ch.tx_partial_writes << " partial, " << ch.tx_eagain << " EAGAIN)"
+                          << std::endl;
             }
-            if (flags & 0x04)
+            if (ch.tx_retried > 0 || ch.tx_rejected > 0 || ch.tx_stale > 0)
             {
-                if (!first)
-                    desc += "+";
-                desc += "CAN Tx buffer overflow";
-                first = false;
+                std::cout << prefix << "TX window: " << ch.tx_window << "/" << ch.tx_window_max << ", "
+                          << ch.tx_retried << " frames resent after #7/#8, " << ch.tx_rejected << " given up, "
+                          << ch.tx_stale << " answers missing" << std::endl;
             }
-            if (flags & 0x08)
+            if (ch.reconnects > 0 || !ch.connected)
             {
-                if (!first)
-                    desc += "+";
-                desc += "USB IN buffer overflow";
-                first = false;
+                std::cout << prefix << "Reconnected " << ch.reconnects << " times, " << ch.gap_ns / 1e9
+                          << " s without the adapter" << (ch.connected ? "" : ", still disconnected") << std::endl;
             }
-            if (flags & 0x10)
+        }
+        if (frames_filtered > 0)
+        {
+            std::cout << "Filter: " << frames_filtered << " frames rejected" << std::endl;
+        }
+        if (!cyclic_messages.empty())
+        {
+            list_cyclic();
+        }
+        print_latency_report(false);
+    }
+
+    // Round trip from handing a marked frame to the driver until its echo
+    // was read, i.e. until the adapter got the frame acknowledged on the bus.
+    // always = false skips channels that never used markers.
+    void print_latency_report(bool always = true)
+    {
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            const Channel &ch = *channels[c];
+            if (!always && ch.markers_sent == 0 && ch.markers_unmatched == 0)
+                continue;
+            std::string prefix = channels.size() > 1 ? tag("", ch.index) + " " : "";
+
+            uint64_t echoed = ch.echo_latency.count();
+            std::cout << prefix << "Tx echo: " << ch.markers_sent << " markers sent, " << echoed << " echoed, "
+                      << ch.markers_lost << " lost, " << ch.markers_unmatched << " unmatched" << std::endl;
+            if (echoed == 0)
             {
-                if (!first)
-                    desc += "+";
-                desc += "Tx Timeout";
-                first = false;
+                if (ch.markers_sent == 0)
+                {
+                    std::cout << prefix << "No marked frames sent yet, enable Tx echo markers with MM" << std::endl;
+                }
+                continue;
             }
+            const LatencyHistogram &h = ch.echo_latency;
+            std::cout << prefix << "Tx latency: min " << h.min() / 1000.0
+                      << " us, mean " << h.mean() / 1000.0
+                      << " us, p50 " << h.percentile(50) / 1000.0
+                      << " us, p90 " << h.percentile(90) / 1000.0
+                      << " us, p99 " << h.percentile(99) / 1000.0
+                      << " us, p99.9 " << h.percentile(99.9) / 1000.0
+                      << " us, max " << h.max() / 1000.0 << " us" << std::endl;
         }
+    }
 
-        // Digits 5+6: Tx Error Count
-        std::string tx_err = error_code.substr(4, 2);
-        int tx_count = std::stoi(tx_err, nullptr, 16);
+    // Handles the scheduler commands of the prompt and of scripts:
+    //   cyclic add <period> [<n>:]<frame> [counter=<byte>[/<mask>]]
+    //   cyclic start|stop|del <n>|all
+    //   cyclic [list]
+    // Returns false if cmd is not a cyclic command.
+    bool cyclic_command(const std::string &cmd)
+    {
+        std::istringstream in(cmd);
+        std::string word, action, which;
+        in >> word;
+        if (word != "cyclic")
+        {
+            return false;
+        }
+        if (!(in >> action) || action == "list")
+        {
+            list_cyclic();
+            return true;
+        }
+        if (action == "add")
+        {
+            add_cyclic(in);
+            return true;
+        }
+        if ((action != "start" && action != "stop" && action != "del") || !(in >> which))
+        {
+            std::cerr << "Error: Usage: cyclic add|start|stop|del|list" << std::endl;
+            return true;
+        }
 
-        // Digits 7+8: Rx Error Count
-        std::string rx_err = error_code.substr(6, 2);
-        int rx_count = std::stoi(rx_err, nullptr, 16);
+        unsigned long number = which == "all" ? 0 : strtoul(which.c_str(), nullptr, 10);
+        std::lock_guard<std::mutex> lock(cyclic_mutex);
+        bool found = false;
+        for (size_t i = 0; i < cyclic_messages.size(); i++)
+        {
+            if (!cyclic_messages[i].used || (number != 0 && number != i + 1))
+                continue;
+            found = true;
+            run_cyclic(i, action == "start");
+            if (action == "del")
+            {
+                cyclic_messages[i].used = false;
+            }
+        }
+        if (!found)
+        {
+            std::cerr << "Error: No cyclic message " << which << std::endl;
+        }
+        return true;
+    }
 
-        desc += ", Tx Errors: " + std::to_string(tx_count);
-        desc += ", Rx Errors: " + std::to_string(rx_count);
-        desc += ")";
+    // Period, counts and jitter of every cyclic message. Jitter is the
+    // interval between two queued frames minus the period.
+    void list_cyclic()
+    {
+        std::lock_guard<std::mutex> lock(cyclic_mutex);
+        bool any = false;
+        for (size_t i = 0; i < cyclic_messages.size(); i++)
+        {
+            const CyclicMessage &m = cyclic_messages[i];
+            if (!m.used)
+                continue;
+            any = true;
+            std::cout << "[CYCLIC] #" << i + 1 << " " << (m.running ? "running" : "stopped") << ", every "
+                      << m.period_ticks * CYCLIC_TICK_NS / 1e6 << " ms: " << m.text << std::endl;
+            std::cout << "         " << m.sent << " sent, " << m.overruns << " overruns, " << m.queue_full
+                      << " dropped (TX queue full)";
+            if (m.intervals > 0)
+            {
+                std::cout << ", jitter min " << m.jitter_min_ns / 1000.0 << " us, mean |"
+                          << m.jitter_abs_ns / m.intervals / 1000.0 << "| us, max " << m.jitter_max_ns / 1000.0
+                          << " us";
+            }
+            std::cout << std::endl;
+        }
+        if (!any)
+        {
+            std::cout << "[CYCLIC] No messages, add one with: cyclic add <period> <frame>" << std::endl;
+        }
+    }
 
-        return desc;
+    // Keeps the --stats and --sniff dashboard's copy of the line being typed
+    void set_prompt_input(const std::string &input)
+    {
+        if (stats_enabled)
+        {
+            std::lock_guard<std::mutex> lock(prompt_mutex);
+            prompt_input = input;
+        }
     }
 
-    void receive_thread_func()
+    void run_terminal()
     {
-        char buf[256];
+        if (!start_io())
+        {
+            return;
+        }
 
-        while (running)
+        setup_stdin();
+        interactive = true;
+
+        std::cout << "\n=== SLCAN Terminal ===" << std::endl;
+        for (size_t c = 0; c < channels.size(); c++)
         {
-            int n = read(fd, buf, sizeof(buf) - 1);
-            if (n > 0)
+            std::cout << "Connected to: " << channels[c]->tty_path;
+            if (channels.size() > 1)
             {
-                buf[n] = '\0';
-                std::string response(buf);
+                std::cout << " (channel " << c << ")";
+            }
+            std::cout << std::endl;
+        }
+        if (channels.size() > 1)
+        {
+            std::cout << "Channels: '<n>:<cmd>' sends to channel n only, other commands go to all channels" << std::endl;
+        }
+        std::cout << "Commands: Enter SLCAN commands (e.g., 'V' for version, 'O' to open)" << std::endl;
+        std::cout << "Special: 'quit' or 'exit' to close, 'latency' for Tx echo statistics, Ctrl+C to abort" << std::endl;
+        std::cout << "======================\n"
+                  << std::endl;
 
-                // Split by \r in case multiple messages are received
-                std::vector<std::string> messages;
-                std::stringstream ss(response);
-                std::string message;
+        std::string input_buffer;
 
-                while (std::getline(ss, message, '\r'))
-                {
-                    if (!message.empty())
-                    {
-                        messages.push_back(message);
-                    }
-                }
+        while (running)
+        {
+            std::cout << "> " << std::flush;
 
-                // Process each message separately
-                for (const auto &msg : messages)
+            // Read line from stdin
+            input_buffer.clear();
+            char ch;
+            while (read(STDIN_FILENO, &ch, 1) > 0)
+            {
+                if (ch == '\n' || ch == '\r')
                 {
-                    // Try both feedback and error descriptions
-                    std::string description = get_feedback_description(msg);
-                    if (description.empty())
+                    std::cout << std::endl;
+                    set_prompt_input("");
+                    break;
+                }
+                else if (ch == 127 || ch == 8)
+                { // Backspace
+                    if (!input_buffer.empty())
                     {
-                        description = get_error_description(msg);
+                        input_buffer.pop_back();
+                        set_prompt_input(input_buffer);
+                        std::cout << "\b \b" << std::flush;
                     }
+                }
+                else if (ch == 3)
+                { // Ctrl+C
+                    stop();
+                    break;
+                }
+                else if (ch >= 32 && ch < 127)
+                { // Printable characters
+                    input_buffer += ch;
+                    set_prompt_input(input_buffer);
+                    std::cout << ch << std::flush;
+                }
+            }
 
-                    // Remove trailing newline for cleaner display
-                    std::string display_response = msg;
-                    while (!display_response.empty() && display_response.back() == '\n')
-                    {
-                        display_response.pop_back();
-                    }
+            if (!running)
+                break;
 
-                    std::cout << "\r\033[K[RX] " << display_response;
-                    if (!description.empty())
-                    {
-                        std::cout << description;
-                    }
-                    std::cout << std::endl;
+            // Process command
+            if (!input_buffer.empty())
+            {
+                if (input_buffer == "quit" || input_buffer == "exit")
+                {
+                    stop();
+                    break;
+                }
+                if (input_buffer == "latency")
+                {
+                    print_latency_report();
+                    continue;
+                }
+                if (cyclic_command(input_buffer))
+                {
+                    continue;
                 }
-                std::cout << "> " << std::flush;
+
+                send_command(input_buffer);
             }
-            usleep(10000); // 10ms delay to prevent busy-waiting
         }
-    }
 
-public:
-    SlcanTerminal(const std::string &tty) : tty_path(tty), fd(-1), running(false) {}
+        restore_stdin();
+        stop_io();
 
-    ~SlcanTerminal()
+        std::cout << "\nTerminal closed." << std::endl;
+    }
+
+    // Starts writing all received frames to a candump log file.
+    // The interface name in the log is the TTY name, e.g. ttyACM0.
+    bool open_capture_log(const std::string &path)
     {
-        if (running)
+        capture_log.reset(new CaptureLog());
+        std::vector<std::string> ifaces;
+        for (size_t c = 0; c < channels.size(); c++)
         {
-            stop();
+            ifaces.push_back(channels[c]->name);
         }
-        if (fd >= 0)
+        if (!capture_log->open(path, ifaces, notices))
         {
-            restore_serial();
-            close(fd);
+            capture_log.reset();
+            return false;
         }
+        return true;
     }
 
-    bool open_device()
+    // Arms the trigger capture, see TriggerCapture. conditions are the
+    // --trigger options; captures are written to <prefix>-<n>.log.
+    bool open_trigger(const std::vector<std::string> &conditions, const std::string &prefix, size_t pre,
+                      size_t post)
     {
-        // Check if the path exists and resolve symlinks
-        struct stat st;
-        if (stat(tty_path.c_str(), &st) < 0)
+        trigger.reset(new TriggerCapture());
+        for (size_t i = 0; i < conditions.size(); i++)
         {
-            perror(tty_path.c_str());
-            return false;
-        }
-
-        // Check if it's a character device
-        if (!S_ISCHR(st.st_mode))
-        {
-            std::cerr << "Error: " << tty_path << " is not a character device" << std::endl;
-            return false;
+            if (!trigger->add_conditions(conditions[i]))
+            {
+                trigger.reset();
+                return false;
+            }
         }
-
-        // Open the device
-        fd = open(tty_path.c_str(), O_RDWR | O_NOCTTY);
-        if (fd < 0)
+        std::vector<std::string> ifaces;
+        for (size_t c = 0; c < channels.size(); c++)
         {
-            perror(tty_path.c_str());
-            return false;
+            ifaces.push_back(channels[c]->name);
         }
-
-        // Try to get exclusive access to the serial port
-        // This will fail if the port is already in use
-        if (ioctl(fd, TIOCEXCL) < 0)
+        if (!trigger->open(prefix, ifaces, pre, post, notices))
         {
-            perror("Cannot get exclusive access (port already in use?)");
-            close(fd);
-            fd = -1;
+            trigger.reset();
             return false;
         }
+        return true;
+    }
 
-        // Try to configure as serial port - this will fail if it's not a TTY
-        struct termios tty;
-        if (tcgetattr(fd, &tty) < 0)
+    // Shows received frames as the signal values of a DBC file
+    bool load_dbc(const std::string &path)
+    {
+        dbc.reset(new DbcDecoder());
+        if (!dbc->load(path))
         {
-            std::cerr << "Error: " << tty_path << " - cannot get terminal attributes (not a TTY?)" << std::endl;
-            close(fd);
-            fd = -1;
+            dbc.reset();
             return false;
         }
-
-        setup_serial_port();
+        std::cout << "DBC: " << dbc->message_count() << " messages, " << dbc->total_signals() << " signals from "
+                  << path << std::endl;
         return true;
     }
 
-    char encode_dlc(int byte_count)
+    // Publishes all received frames in a shared memory ring for other
+    // processes. The interface names are the TTY names as in the log.
+    bool open_shm(const std::string &name)
     {
-        // Convert byte count to SLCAN DLC format
-        if (byte_count <= 8)
+        shm_ring.reset(new SlcanShmWriter());
+        std::vector<std::string> ifaces;
+        for (size_t c = 0; c < channels.size(); c++)
         {
-            return '0' + byte_count;
+            ifaces.push_back(channels[c]->name);
         }
-        else
+        if (!shm_ring->open(name, ifaces))
         {
-            // CAN FD DLC encoding
-            if (byte_count <= 12)
-                return '9';
-            else if (byte_count <= 16)
-                return 'A';
-            else if (byte_count <= 20)
-                return 'B';
-            else if (byte_count <= 24)
-                return 'C';
-            else if (byte_count <= 32)
-                return 'D';
-            else if (byte_count <= 48)
-                return 'E';
-            else
-                return 'F';
+            shm_ring.reset();
+            return false;
         }
+        return true;
     }
 
-    std::string convert_cansend_format(const std::string &input)
+    // Loads and pre-encodes a candump log, so that playback only has to
+    // copy ready SLCAN packets into the TX queue
+    bool load_replay(const std::string &path)
     {
-        // Check if input contains # (cansend format: <packet_type><can_id>#<data>)
-        size_t hash_pos = input.find('#');
-        if (hash_pos == std::string::npos)
+        std::ifstream in(path.c_str());
+        if (!in)
         {
-            // No # found, return as-is (already in SLCAN format)
-            return input;
-        }
-
-        // Extract packet type (first character)
-        if (input.empty())
-        {
-            return input;
+            std::cerr << "Error: Cannot open replay file: " << path << std::endl;
+            return false;
         }
 
-        char packet_type = input[0];
+        replay_frames.clear();
+        replay_data.clear();
 
-        // Validate packet type (t, T, r, R, d, D, b, B)
-        if (packet_type != 't' && packet_type != 'T' &&
-            packet_type != 'r' && packet_type != 'R' &&
-            packet_type != 'd' && packet_type != 'D' &&
-            packet_type != 'b' && packet_type != 'B')
+        // Interfaces in the order they first appear, one per channel
+        std::vector<std::string> ifaces;
+        std::string line;
+        size_t skipped = 0;
+        uint64_t first_ns = 0;
+        uint64_t last_offset = 0;
+        while (std::getline(in, line))
         {
-            std::cerr << "Error: Invalid packet type '" << packet_type << "' (use t,T,r,R,d,D,b,B)" << std::endl;
-            return input;
-        }
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+            {
+                continue;
+            }
 
-        // Split into CAN ID and data parts (skip packet type)
-        std::string can_id_str = input.substr(1, hash_pos - 1);
-        std::string data_str = input.substr(hash_pos + 1);
+            uint64_t time_ns;
+            std::string iface;
+            std::string command;
+            if (!parse_candump_line(line, time_ns, iface, command))
+            {
+                skipped++;
+                continue;
+            }
+            size_t channel = std::find(ifaces.begin(), ifaces.end(), iface) - ifaces.begin();
+            if (channel == ifaces.size())
+            {
+                ifaces.push_back(iface);
+            }
+            if (channel >= channels.size())
+            {
+                skipped++;
+                continue;
+            }
 
-        // Remove dots and spaces from data
-        std::string clean_data;
-        for (char c : data_str)
-        {
-            if (c != '.' && c != ' ')
+            char packet[SLCAN_MAX_COMMAND];
+            size_t len = encode_command(command.c_str(), command.length(), packet);
+            if (len == 0)
             {
-                clean_data += c;
+                skipped++;
+                continue;
             }
-        }
 
-        // Validate data is hex
-        for (char c : clean_data)
-        {
-            if (!std::isxdigit(c))
+            if (replay_frames.empty())
             {
-                std::cerr << "Error: Invalid hex data: " << clean_data << std::endl;
-                return input; // Return original on error
+                first_ns = time_ns;
             }
+
+            // Keep the timeline monotonic even if the log is not
+            ReplayFrame frame;
+            frame.offset_ns = (time_ns > first_ns) ? time_ns - first_ns : 0;
+            frame.offset_ns = std::max(frame.offset_ns, last_offset);
+            frame.channel = channel;
+            frame.pos = replay_data.size();
+            frame.len = len;
+            last_offset = frame.offset_ns;
+
+            replay_data.append(packet, len);
+            replay_frames.push_back(frame);
         }
 
-        // Calculate DLC (data length in bytes)
-        if (clean_data.length() % 2 != 0)
+        if (replay_frames.empty())
         {
-            std::cerr << "Error: Data must have even number of hex digits" << std::endl;
-            return input;
+            std::cerr << "Error: No CAN frames found in replay file: " << path << std::endl;
+            return false;
         }
 
-        int dlc = clean_data.length() / 2;
-        if (dlc > 64)
+        std::cout << "Replay: loaded " << replay_frames.size() << " frames spanning "
+                  << last_offset / 1e9 << " s";
+        if (skipped > 0)
         {
-            std::cerr << "Error: Data too long (max 64 bytes)" << std::endl;
-            return input;
+            std::cout << " (" << skipped << " lines skipped)";
         }
-
-        // Convert DLC to SLCAN format
-        char dlc_char = encode_dlc(dlc);
-
-        // Determine ID format based on packet type
-        std::string formatted_id;
-        bool is_extended = (packet_type == 'T' || packet_type == 'R' ||
-                            packet_type == 'D' || packet_type == 'B');
-
-        if (is_extended)
+        std::cout << std::endl;
+        for (size_t i = 0; i < ifaces.size() && channels.size() > 1; i++)
         {
-            // Extended 29-bit ID (8 hex digits)
-            if (can_id_str.length() > 8)
-            {
-                std::cerr << "Error: Extended CAN ID too long (max 8 hex digits)" << std::endl;
-                return input;
-            }
-            formatted_id = std::string(8 - can_id_str.length(), '0') + can_id_str;
+            std::cout << "Replay: " << ifaces[i] << " -> ";
+            std::cout << (i < channels.size() ? channels[i]->tty_path : std::string("skipped, no channel left"));
+            std::cout << std::endl;
         }
-        else
+        if (ifaces.size() > channels.size())
         {
-            // Standard 11-bit ID (3 hex digits)
-            if (can_id_str.length() > 3)
-            {
-                std::cerr << "Error: Standard CAN ID too long (max 3 hex digits)" << std::endl;
-                return input;
-            }
-            formatted_id = std::string(3 - can_id_str.length(), '0') + can_id_str;
+            std::cerr << "Warning: The log has " << ifaces.size() << " interfaces but only " << channels.size()
+                      << " adapter(s) are open" << std::endl;
         }
+        return true;
+    }
 
-        // Validate CAN ID is hex
-        for (char c : can_id_str)
+    // Transmits the loaded log on an absolute timeline: every frame is due at
+    // start + offset / speed, so oversleeping once does not delay the rest.
+    // loops = 0 repeats until stopped.
+    void run_replay(double speed, unsigned loops)
+    {
+        if (!start_io())
         {
-            if (!std::isxdigit(c))
-            {
-                std::cerr << "Error: Invalid CAN ID (must be hex): " << can_id_str << std::endl;
-                return input;
-            }
+            return;
         }
 
-        // Construct SLCAN packet
-        std::string slcan_packet;
-        slcan_packet += packet_type;
-        slcan_packet += formatted_id;
-        slcan_packet += dlc_char;
-        slcan_packet += clean_data;
+        // The next loop starts one average frame gap after the last frame
+        uint64_t duration = replay_frames.back().offset_ns;
+        uint64_t period = duration + duration / std::max<size_t>(replay_frames.size() - 1, 1);
 
-        return slcan_packet;
-    }
+        LatencyHistogram lateness;
+        size_t sent = 0;
+        unsigned full_loops = 0;
+        size_t loop_sent = 0; // Frames of the last loop started
 
-    void send_command(const std::string &cmd, bool show_output = true)
-    {
-        // Convert cansend format to SLCAN if needed
-        std::string command = convert_cansend_format(cmd);
+        std::cout << "Replay: " << replay_frames.size() << " frames, speed x" << speed << ", "
+                  << (loops ? std::to_string(loops) : std::string("endless")) << " loop(s)" << std::endl;
 
-        // Add carriage return if not present
-        if (command.empty() || command.back() != '\r')
+        uint64_t start = monotonic_ns() + 10000000ull;
+        for (unsigned loop = 0; running && (loops == 0 || loop < loops); loop++)
         {
-            command += '\r';
+            loop_sent = 0;
+            for (size_t i = 0; running && i < replay_frames.size(); i++)
+            {
+                const ReplayFrame &frame = replay_frames[i];
+                uint64_t target = start + (uint64_t)((loop * period + frame.offset_ns) / speed);
+
+                if (target > monotonic_ns())
+                {
+                    struct timespec ts;
+                    ts.tv_sec = target / 1000000000ull;
+                    ts.tv_nsec = target % 1000000000ull;
+                    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR && running)
+                        ;
+                    if (!running)
+                        break;
+                }
+
+                // clock_nanosleep() never returns early, a frame is on time or late
+                uint64_t now = monotonic_ns();
+                lateness.record(now > target ? now - target : 0);
+
+                if (!enqueue_tx_wait(*channels[frame.channel], &replay_data[frame.pos], frame.len))
+                    break;
+                sent++;
+                loop_sent++;
+            }
+            if (loop_sent < replay_frames.size())
+                break;
+            full_loops++;
         }
 
-        ssize_t written = write(fd, command.c_str(), command.length());
-        if (written < 0)
+        // Give the adapter time to answer the last frames
+        wait_tx_drain();
+        usleep(100000);
+        stop_io();
+
+        std::cout << "Replay: sent " << sent << " frames in " << full_loops << " full loop(s)";
+        if (loop_sent > 0 && loop_sent < replay_frames.size())
         {
-            perror("write");
+            std::cout << ", interrupted after " << loop_sent << " of " << replay_frames.size()
+                      << " frames of the next loop";
         }
-        else if (show_output)
+        std::cout << std::endl;
+        if (lateness.count() > 0)
         {
-            std::cout << "[TX] " << command;
-            if (command.back() == '\r')
-            {
-                std::cout << std::endl;
-            }
+            std::cout << "Replay jitter (send time - schedule): mean " << lateness.mean() / 1000.0 << " us, median "
+                      << lateness.percentile(50) / 1000.0 << " us, p99 " << lateness.percentile(99) / 1000.0
+                      << " us, max " << lateness.max() / 1000.0 << " us" << std::endl;
         }
     }
 
-    void send_init_commands(const std::vector<std::string> &commands)
+    // Streams commands from a file or pipe to the adapter without any
+    // terminal handling. Input is read in large blocks and split into lines.
+    // A line may end with a delay directive " @<time>" (e.g. "t123#11 @10ms")
+    // or consist of the directive only; delays are kept on an absolute
+    // timeline. Empty lines and lines starting with '#' are ignored.
+    void run_script(int input_fd, const std::string &name)
     {
-        if (commands.empty())
+        if (!start_io())
         {
             return;
         }
 
-        std::cout << "\n=== Sending initialization commands ===" << std::endl;
+        std::vector<char> buf(64 * 1024);
+        size_t len = 0;
+        uint64_t sent = 0;
+        uint64_t skipped = 0;
+        uint64_t start = monotonic_ns();
+        uint64_t deadline = start;
+        bool done = false;
+        bool skip_line = false; // Discarding the rest of an overlong line
 
-        for (const auto &cmd : commands)
+        while (running && !done)
         {
-            std::cout << "[INIT] " << cmd << std::endl;
-            send_command(cmd, false);
-            usleep(50000); // 50ms delay between commands
+            if (len == buf.size())
+            {
+                // A line longer than the whole buffer cannot be a command
+                skipped++;
+                len = 0;
+                skip_line = true;
+            }
 
-            // Try to read response
-            char buf[256];
-            usleep(50000); // Wait for response
-            int n = read(fd, buf, sizeof(buf) - 1);
-            if (n > 0)
+            ssize_t n = read(input_fd, &buf[len], buf.size() - len);
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n < 0)
+            {
+                perror(name.c_str());
+                break;
+            }
+            if (n == 0)
+            {
+                // EOF: the last line does not need a newline
+                if (len == 0)
+                    break;
+                buf[len++] = '\n';
+                done = true;
+            }
+            else
+            {
+                len += n;
+            }
+
+            size_t pos = 0;
+            if (skip_line)
+            {
+                const char *nl = static_cast<const char *>(memchr(&buf[0], '\n', len));
+                if (!nl)
+                {
+                    len = 0;
+                    continue;
+                }
+                pos = nl - &buf[0] + 1;
+                skip_line = false;
+            }
+            for (;;)
             {
-                buf[n] = '\0';
-                std::string response(buf);
+                const char *nl = static_cast<const char *>(memchr(&buf[pos], '\n', len - pos));
+                if (!nl)
+                    break;
 
-                // Split by \r in case multiple messages are received
-                std::vector<std::string> messages;
-                std::stringstream ss(response);
-                std::string message;
+                const char *first = &buf[pos];
+                const char *last = nl;
+                pos = nl - &buf[0] + 1;
 
-                while (std::getline(ss, message, '\r'))
+                while (first < last && (*first == ' ' || *first == '\t'))
+                    first++;
+                while (last > first && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '\r'))
+                    last--;
+                if (first == last || *first == '#')
+                    continue;
+
+                // Split off the delay directive
+                uint64_t delay = 0;
+                bool has_delay = false;
+                const char *at = static_cast<const char *>(memchr(first, '@', last - first));
+                if (at && (at == first || at[-1] == ' ' || at[-1] == '\t'))
                 {
-                    if (!message.empty())
+                    if (!parse_delay(at + 1, last - at - 1, delay))
                     {
-                        messages.push_back(message);
+                        std::cerr << "Error: Invalid delay: " << std::string(at, last) << std::endl;
+                        skipped++;
+                        continue;
                     }
+                    has_delay = true;
+                    last = at;
+                    while (last > first && (last[-1] == ' ' || last[-1] == '\t'))
+                        last--;
                 }
 
-                // Process each message separately
-                for (const auto &msg : messages)
+                if (first < last)
                 {
-                    // Try both feedback and error descriptions
-                    std::string description = get_feedback_description(msg);
-                    if (description.empty())
+                    // Frames are encoded straight from the read buffer, only
+                    // the rare cyclic and quit commands become strings
+                    size_t cmd_len = last - first;
+                    if (cmd_len == 4 && (memcmp(first, "quit", 4) == 0 || memcmp(first, "exit", 4) == 0))
                     {
-                        description = get_error_description(msg);
+                        done = true;
+                        break;
                     }
-
-                    // Remove trailing newline for cleaner display
-                    std::string display_response = msg;
-                    while (!display_response.empty() && display_response.back() == '\n')
+                    if (cmd_len >= 6 && memcmp(first, "cyclic", 6) == 0 && cyclic_command(std::string(first, last)))
                     {
-                        display_response.pop_back();
+                        // Added to or changed the cyclic scheduler
                     }
-
-                    std::cout << "[RESP] " << display_response;
-                    if (!description.empty())
+                    else
                     {
-                        std::cout << description;
+                        int channel;
+                        char packet[SLCAN_MAX_COMMAND];
+                        size_t packet_len = 0;
+                        if (split_channel(first, last, channel))
+                        {
+                            packet_len = encode_command(first, last - first, packet);
+                        }
+                        if (packet_len == 0)
+                        {
+                            skipped++;
+                        }
+                        else
+                        {
+                            for (size_t c = 0; c < channels.size(); c++)
+                            {
+                                if ((channel < 0 || (int)c == channel) &&
+                                    enqueue_tx_wait(*channels[c], packet, packet_len))
+                                {
+                                    sent++;
+                                }
+                            }
+                        }
                     }
-                    std::cout << std::endl;
                 }
+
+                if (has_delay)
+                {
+                    deadline = std::max(deadline, monotonic_ns()) + delay;
+                    struct timespec ts;
+                    ts.tv_sec = deadline / 1000000000ull;
+                    ts.tv_nsec = deadline % 1000000000ull;
+                    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR && running)
+                        ;
+                }
+
+                if (!running)
+                    break;
             }
+
+            // Keep the partial last line for the next read
+            memmove(&buf[0], &buf[pos], len - pos);
+            len -= pos;
         }
 
-        std::cout << "=== Initialization complete ===\n"
-                  << std::endl;
+        double seconds = (monotonic_ns() - start) / 1e9;
+
+        // Give the adapter time to answer the last commands
+        wait_tx_drain();
+        usleep(100000);
+        stop_io();
+
+        std::cout << "Script: " << sent << " commands sent in " << seconds << " s";
+        if (seconds > 0)
+        {
+            std::cout << " (" << (uint64_t)(sent / seconds) << " commands/s)";
+        }
+        if (skipped > 0)
+        {
+            std::cout << ", " << skipped << " lines skipped";
+        }
+        std::cout << std::endl;
     }
 
-    void run_terminal()
+    // Sends frames of one type at a fixed rate (0 = as fast as the adapter
+    // takes them) for the given time and counts the ones that come back,
+    // e.g. with the adapter opened in loopback mode (OI / OE). The first 4
+    // data bytes of each frame carry a sequence number.
+    void run_bench(char type, unsigned len, unsigned rate, double seconds)
     {
-        running = true;
+        bool fd = (type == 'd' || type == 'D' || type == 'b' || type == 'B');
+        bool extended = (type >= 'A' && type <= 'Z');
+
+        // Smallest DLC that holds len bytes
+        unsigned dlc = len_to_dlc[len > 64 ? 64 : len];
+        len = dlc_to_len[dlc];
+        if (!fd && len > 8)
+        {
+            std::cerr << "Error: Classic frames carry at most 8 bytes, use type d or b for CAN FD" << std::endl;
+            return;
+        }
 
-        // Start receiver thread
-        std::thread rx_thread(&SlcanTerminal::receive_thread_func, this);
+        bench.id = extended ? 0x12345678 : 0x123;
+        bench.extended = extended;
+        bench.next_seq = 0;
 
-        setup_stdin();
+        char frame[TxQueue::SLOT_SIZE];
+        int id_digits = extended ? 8 : 3;
+        int pos = 0;
+        frame[pos++] = type;
+        for (int i = id_digits - 1; i >= 0; i--)
+        {
+            frame[pos++] = hex_upper[(bench.id >> (4 * i)) & 0x0F];
+        }
+        frame[pos++] = hex_upper[dlc];
+        int data_pos = pos;
+        for (unsigned i = 0; i < len; i++)
+        {
+            frame[pos++] = hex_upper[(i >> 4) & 0x0F];
+            frame[pos++] = hex_upper[i & 0x0F];
+        }
+        frame[pos++] = '\r';
 
-        std::cout << "\n=== SLCAN Terminal ===" << std::endl;
-        std::cout << "Connected to: " << tty_path << std::endl;
-        std::cout << "Commands: Enter SLCAN commands (e.g., 'V' for version, 'O' to open)" << std::endl;
-        std::cout << "Special: 'quit' or 'exit' to close, Ctrl+C to abort" << std::endl;
-        std::cout << "======================\n"
-                  << std::endl;
+        if (!start_io())
+        {
+            return;
+        }
+        bench.active = true;
 
-        std::string input_buffer;
+        std::cout << "Bench: " << type << " frames with " << len << " data bytes, "
+                  << (rate ? std::to_string(rate) + " frames/s" : std::string("max. rate")) << " for " << seconds
+                  << " s" << std::endl;
+
+        double cpu_main = thread_cpu_seconds(pthread_self());
+        double cpu_rx = thread_cpu_seconds(rx_thread.native_handle());
+        double cpu_tx = thread_cpu_seconds(channels[0]->tx_thread.native_handle());
+        double cpu_display = thread_cpu_seconds(display_thread.native_handle());
+
+        uint64_t start = monotonic_ns();
+        uint64_t end = start + (uint64_t)(seconds * 1e9);
+        uint64_t next_report = start + 1000000000ull;
+        uint64_t sent = 0;
+        uint64_t reported_sent = 0;
+        uint64_t reported_rx = 0;
 
         while (running)
         {
-            std::cout << "> " << std::flush;
+            uint64_t now = monotonic_ns();
+            if (now >= end)
+                break;
 
-            // Read line from stdin
-            input_buffer.clear();
-            char ch;
-            while (read(STDIN_FILENO, &ch, 1) > 0)
+            // Frames due by now, or a block of them at maximum rate
+            uint64_t due = rate ? (now - start) * rate / 1000000000ull + 1 : sent + 256;
+            while (sent < due && running)
             {
-                if (ch == '\n' || ch == '\r')
+                if (len >= 4)
                 {
-                    std::cout << std::endl;
-                    break;
-                }
-                else if (ch == 127 || ch == 8)
-                { // Backspace
-                    if (!input_buffer.empty())
+                    for (int i = 0; i < 8; i++)
                     {
-                        input_buffer.pop_back();
-                        std::cout << "\b \b" << std::flush;
+                        frame[data_pos + i] = hex_upper[(sent >> (28 - 4 * i)) & 0x0F];
                     }
                 }
-                else if (ch == 3)
-                { // Ctrl+C
-                    running = false;
+                if (!enqueue_tx_wait(*channels[0], frame, pos))
                     break;
-                }
-                else if (ch >= 32 && ch < 127)
-                { // Printable characters
-                    input_buffer += ch;
-                    std::cout << ch << std::flush;
-                }
+                sent++;
             }
 
-            if (!running)
-                break;
-
-            // Process command
-            if (!input_buffer.empty())
+            now = monotonic_ns();
+            if (now >= next_report)
             {
-                if (input_buffer == "quit" || input_buffer == "exit")
-                {
-                    running = false;
-                    break;
-                }
+                uint64_t rx = bench.frames;
+                std::cout << "\r\033[K[BENCH] TX " << (sent - reported_sent) << " frames/s, RX " << (rx - reported_rx)
+                          << " frames/s" << std::endl;
+                reported_sent = sent;
+                reported_rx = rx;
+                next_report += 1000000000ull;
+            }
 
-                send_command(input_buffer);
+            if (rate)
+            {
+                uint64_t next = start + sent * 1000000000ull / rate;
+                struct timespec ts;
+                ts.tv_sec = next / 1000000000ull;
+                ts.tv_nsec = next % 1000000000ull;
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR && running)
+                    ;
             }
         }
+        double tx_seconds = (monotonic_ns() - start) / 1e9;
 
-        restore_stdin();
+        // Let the adapter send and return the last frames
+        wait_tx_drain();
+        uint64_t rx = bench.frames;
+        for (int i = 0; i < 10 && running; i++)
+        {
+            usleep(100000);
+            uint64_t now_rx = bench.frames;
+            if (now_rx == rx && i > 0)
+                break;
+            rx = now_rx;
+        }
+        double total_seconds = (monotonic_ns() - start) / 1e9;
+        double rx_seconds = bench.last_ns > start ? (bench.last_ns - start) / 1e9 : total_seconds;
 
-        // Wait for receiver thread to finish
-        rx_thread.join();
+        cpu_main = thread_cpu_seconds(pthread_self()) - cpu_main;
+        cpu_rx = thread_cpu_seconds(rx_thread.native_handle()) - cpu_rx;
+        cpu_tx = thread_cpu_seconds(channels[0]->tx_thread.native_handle()) - cpu_tx;
+        cpu_display = thread_cpu_seconds(display_thread.native_handle()) - cpu_display;
 
-        std::cout << "\nTerminal closed." << std::endl;
+        bench.active = false;
+        stop_io();
+
+        rx = bench.frames;
+        std::cout << "\nBench TX: " << sent << " frames in " << tx_seconds << " s, " << (uint64_t)(sent / tx_seconds)
+                  << " frames/s, " << (uint64_t)(sent * len / tx_seconds) << " data bytes/s, "
+                  << (uint64_t)(sent * pos / tx_seconds) << " serial bytes/s" << std::endl;
+        std::cout << "Bench RX: " << rx << " frames, " << (uint64_t)(rx / rx_seconds) << " frames/s, "
+                  << (uint64_t)(bench.data_bytes / rx_seconds) << " data bytes/s, "
+                  << (uint64_t)(bench.serial_bytes / rx_seconds) << " serial bytes/s" << std::endl;
+        if (rx == 0)
+        {
+            std::cout << "No frames came back, own frames are only received in loopback mode (OI / OE)" << std::endl;
+        }
+        else
+        {
+            uint64_t lost = sent > rx ? sent - rx : 0;
+            std::cout << "Bench loss: " << lost << " frames (" << (sent ? 100.0 * lost / sent : 0.0) << "%), "
+                      << bench.reordered << " out of order" << std::endl;
+        }
+
+        if (bench.error_reports > 0)
+        {
+            unsigned flags = bench.error_flags;
+            std::cout << "Adapter: " << bench.error_reports << " error reports";
+            if (flags & 0x08)
+                std::cout << ", USB IN buffer overflow";
+            if (flags & 0x04)
+                std::cout << ", CAN Tx buffer overflow";
+            std::cout << std::endl;
+            SlcanRecord last = {bench.last_error.data(), bench.last_error.size()};
+            std::cout << "Last error report: " << bench.last_error << get_error_description(last) << std::endl;
+        }
+
+        std::cout << "CPU: main " << 100.0 * cpu_main / total_seconds << "%, RX " << 100.0 * cpu_rx / total_seconds
+                  << "%, TX " << 100.0 * cpu_tx / total_seconds << "%, display "
+                  << 100.0 * cpu_display / total_seconds << "%" << std::endl;
     }
 
     void stop()
     {
         running = false;
+
+        // Wake up the RX and TX threads blocked in epoll_wait()
+        signal_eventfd(stop_fd);
+        for (size_t c = 0; c < channels.size(); c++)
+        {
+            signal_eventfd(channels[c]->tx_wake_fd);
+        }
     }
 };
 
@@ -759,15 +5942,51 @@ void print_usage(const char *prg)
 {
     std::cerr << prg << " - Interactive terminal for SLCAN serial communication\n"
               << std::endl;
-    std::cerr << "Usage: " << prg << " [options] [tty_device]\n"
+    std::cerr << "Usage: " << prg << " [options] [tty_device...]\n"
               << std::endl;
     std::cerr << "Options:" << std::endl;
-    std::cerr << "  -h, --help         Show this help message" << std::endl;
-    std::cerr << "  -i, --init <cmds>  Initialization commands (comma-separated)" << std::endl;
-    std::cerr << "                     Use double quotes to protect commas within commands" << std::endl;
+    std::cerr << "  -h, --help            Show this help message" << std::endl;
+    std::cerr << "  -i, --init <cmds>     Initialization commands (comma-separated)" << std::endl;
+    std::cerr << "                        Use double quotes to protect commas within commands" << std::endl;
+    std::cerr << "  -r, --replay <file>   Transmit a candump log (\"(time) iface ID#DATA\") with its timing" << std::endl;
+    std::cerr << "      --speed <x>       Replay speed multiplier (default 1.0)" << std::endl;
+    std::cerr << "      --loop <n>        Replay the log n times, 0 = endless (default 1)" << std::endl;
+    std::cerr << "  -s, --script <file>   Send the commands of a file ('-' = stdin) at full speed" << std::endl;
+    std::cerr << "                        \"<cmd> @<n>[us|ms|s]\" waits after the command," << std::endl;
+    std::cerr << "                        used automatically when stdin is not a terminal" << std::endl;
+    std::cerr << "  -l, --log <file>      Write all received frames to a candump log file" << std::endl;
+    std::cerr << "  -f, --filter <expr>   Only show and log matching frames, e.g. 100-1FF,!123,fd" << std::endl;
+    std::cerr << "                        IDs, ranges, ID:mask, std/ext/rtr/data/classic/fd/brs, ! excludes" << std::endl;
+    std::cerr << "      --dbc <file>      Show received frames as signal values of a DBC file" << std::endl;
+    std::cerr << "      --shm <name>      Publish received frames in a shared memory ring (slcan_shm_reader)" << std::endl;
+    std::cerr << "      --trigger <cond>  Capture the frames around a condition: ID[:mask][#data[/mask]]," << std::endl;
+    std::cerr << "                        passive (error report) or busoff (#8), comma separated" << std::endl;
+    std::cerr << "      --trigger-log <p> Write the captures to <p>-1.log, <p>-2.log, ... (default trigger)" << std::endl;
+    std::cerr << "      --trigger-pre <n> Frames before the trigger in a capture (default 1000)" << std::endl;
+    std::cerr << "      --trigger-post <n>" << std::endl;
+    std::cerr << "                        Frames after the trigger in a capture (default 1000)" << std::endl;
+    std::cerr << "  -t, --timestamps <m>  Show receive times: a = absolute, z = since start, d = delta" << std::endl;
+    std::cerr << "      --reconnect       Reopen an adapter that goes away (USB reset) and repeat -i" << std::endl;
+    std::cerr << "      --low-latency     Set ASYNC_LOW_LATENCY on the serial driver (e.g. FTDI)" << std::endl;
+    std::cerr << "      --read-mode <m>   event = sleep until data arrives (default), spin = busy poll" << std::endl;
+    std::cerr << "      --tx-window <n>   Max. frames in flight with MF/MM, 0 = no flow control (default 64)" << std::endl;
+    std::cerr << "      --stats           Show a live per-ID statistics table instead of every frame" << std::endl;
+    std::cerr << "      --sniff           Show one row per ID with its latest data, changed bytes highlighted" << std::endl;
+    std::cerr << "      --bench           Measure throughput: send frames, count the ones received back" << std::endl;
+    std::cerr << "      --bench-type <c>  Frame type t, T, d, D, b or B (default t)" << std::endl;
+    std::cerr << "      --bench-len <n>   Data bytes per frame, 0-64 (default 8)" << std::endl;
+    std::cerr << "      --bench-rate <n>  Frames per second, 0 = as fast as possible (default 0)" << std::endl;
+    std::cerr << "      --bench-time <s>  Duration in seconds (default 10)" << std::endl;
+    std::cerr << "      --all             Open every adapter found in /dev/serial/by-id" << std::endl;
     std::cerr << "\nIf no tty_device is specified, the tool will automatically search" << std::endl;
     std::cerr << "for the first device in /dev containing 'slcan' in its name.\n"
               << std::endl;
+    std::cerr << "With several devices, received records are tagged [RX<n>] by channel" << std::endl;
+    std::cerr << "and '<n>:<cmd>' sends a command to channel n only.\n"
+              << std::endl;
+    std::cerr << "At the prompt and in scripts 'cyclic add <period> <frame> [counter=<byte>[/<mask>]]'" << std::endl;
+    std::cerr << "sends a frame periodically, 'cyclic [list]|start|stop|del <n>|all' manages them.\n"
+              << std::endl;
     std::cerr << "\nExamples:" << std::endl;
     std::cerr << "  " << prg << "                         (auto-detect SLCAN device)" << std::endl;
     std::cerr << "  " << prg << " /dev/ttyUSB0            (specify device)" << std::endl;
@@ -776,6 +5995,10 @@ void print_usage(const char *prg)
     std::cerr << "  " << prg << " --init \"C,V,S6,ON\" /dev/ttyS1" << std::endl;
     std::cerr << "  " << prg << " -i 's\"1,119,40,40\"'    (custom bitrate with quoted commas)" << std::endl;
     std::cerr << "  " << prg << " -i 'C,s\"1,119,40,40\",ON' (multiple commands with quotes)" << std::endl;
+    std::cerr << "  " << prg << " -i C,S6,ON -r trace.log --speed 2" << std::endl;
+    std::cerr << "  " << prg << " -i C,MF,MM,S8,OI --bench --bench-type b --bench-len 64" << std::endl;
+    std::cerr << "  " << prg << " -i C,S6,ON -l rig.log /dev/ttyACM0 /dev/ttyACM1  (two buses, one log)" << std::endl;
+    std::cerr << "  generator | " << prg << " -i C,S6,ON /dev/ttyACM0  (stream commands from a pipe)" << std::endl;
     std::cerr << "\nCommon SLCAN commands:" << std::endl;
     std::cerr << "  V       - Get version and serial number" << std::endl;
     std::cerr << "  S0-S8   - Set CAN speed (0=10k, 4=125k, 6=500k, 8=1000k)" << std::endl;
@@ -801,54 +6024,8 @@ void print_usage(const char *prg)
     std::cerr << std::endl;
 }
 
-std::vector<std::string> parse_commands(const std::string &cmd_string)
-{
-    std::cout << "command string: " << cmd_string << std::endl;
-
-    std::vector<std::string> commands;
-    std::string current_cmd;
-    bool in_quotes = false;
-
-    for (size_t i = 0; i < cmd_string.length(); i++)
-    {
-        char c = cmd_string[i];
-
-        if (c == '"')
-        {
-            // Toggle quote mode but don't add the quote character
-            in_quotes = !in_quotes;
-        }
-        else if (c == ',' && !in_quotes)
-        {
-            // Comma outside quotes - this is a separator
-            // Trim whitespace from current command
-            size_t start = current_cmd.find_first_not_of(" \t");
-            size_t end = current_cmd.find_last_not_of(" \t");
-            if (start != std::string::npos && end != std::string::npos)
-            {
-                commands.push_back(current_cmd.substr(start, end - start + 1));
-            }
-            current_cmd.clear();
-        }
-        else
-        {
-            // Regular character or comma inside quotes
-            current_cmd += c;
-        }
-    }
-
-    // Don't forget the last command
-    size_t start = current_cmd.find_first_not_of(" \t");
-    size_t end = current_cmd.find_last_not_of(" \t");
-    if (start != std::string::npos && end != std::string::npos)
-    {
-        commands.push_back(current_cmd.substr(start, end - start + 1));
-    }
-
-    return commands;
-}
-
-std::string find_slcan_device()
+// All SLCAN adapters in /dev/serial/by-id, sorted by device name
+std::vector<std::string> find_slcan_devices()
 {
     std::vector<std::string> candidates;
 
@@ -901,26 +6078,106 @@ std::string find_slcan_device()
 
     // Sort to get consistent ordering (prefer lower numbers)
     std::sort(candidates.begin(), candidates.end());
+    return candidates;
+}
+
+// Terminal stopped by SIGINT / SIGTERM
+static SlcanTerminal *signal_terminal = nullptr;
 
-    if (!candidates.empty())
+static void handle_signal(int)
+{
+    if (signal_terminal)
     {
-        return candidates[0];
+        signal_terminal->stop();
     }
-
-    return "";
 }
 
+// Values for options that only have a long form
+enum LongOption
+{
+    OPT_SPEED = 256,
+    OPT_LOOP,
+    OPT_TX_WINDOW,
+    OPT_STATS,
+    OPT_BENCH,
+    OPT_BENCH_TYPE,
+    OPT_BENCH_LEN,
+    OPT_BENCH_RATE,
+    OPT_BENCH_TIME,
+    OPT_ALL,
+    OPT_LOW_LATENCY,
+    OPT_READ_MODE,
+    OPT_SHM,
+    OPT_DBC,
+    OPT_RECONNECT,
+    OPT_SNIFF,
+    OPT_TRIGGER,
+    OPT_TRIGGER_LOG,
+    OPT_TRIGGER_PRE,
+    OPT_TRIGGER_POST,
+};
+
 int main(int argc, char **argv)
 {
     int opt;
     std::vector<std::string> init_commands;
+    std::string replay_file;
+    double replay_speed = 1.0;
+    unsigned replay_loops = 1;
+    std::string log_file;
+    std::string shm_name;
+    std::vector<std::string> trigger_conditions;
+    std::string trigger_log = "trigger";
+    long trigger_pre = TriggerCapture::DEFAULT_PRE;
+    long trigger_post = TriggerCapture::DEFAULT_POST;
+    std::string dbc_file;
+    std::string script_file;
+    long tx_window = 64;
+    bool stats = false;
+    bool sniff = false;
+    bool bench = false;
+    char bench_type = 't';
+    long bench_len = 8;
+    long bench_rate = 0;
+    double bench_time = 10;
+    bool all_devices = false;
+    bool low_latency = false;
+    bool spin_reads = false;
+    bool reconnect = false;
+    char timestamp_mode = 0;
+    std::unique_ptr<FrameFilter> filter;
 
     static struct option long_options[] = {
         {"help", no_argument, 0, 'h'},
         {"init", required_argument, 0, 'i'},
+        {"replay", required_argument, 0, 'r'},
+        {"speed", required_argument, 0, OPT_SPEED},
+        {"loop", required_argument, 0, OPT_LOOP},
+        {"log", required_argument, 0, 'l'},
+        {"script", required_argument, 0, 's'},
+        {"tx-window", required_argument, 0, OPT_TX_WINDOW},
+        {"stats", no_argument, 0, OPT_STATS},
+        {"bench", no_argument, 0, OPT_BENCH},
+        {"bench-type", required_argument, 0, OPT_BENCH_TYPE},
+        {"bench-len", required_argument, 0, OPT_BENCH_LEN},
+        {"bench-rate", required_argument, 0, OPT_BENCH_RATE},
+        {"bench-time", required_argument, 0, OPT_BENCH_TIME},
+        {"all", no_argument, 0, OPT_ALL},
+        {"low-latency", no_argument, 0, OPT_LOW_LATENCY},
+        {"read-mode", required_argument, 0, OPT_READ_MODE},
+        {"filter", required_argument, 0, 'f'},
+        {"shm", required_argument, 0, OPT_SHM},
+        {"dbc", required_argument, 0, OPT_DBC},
+        {"reconnect", no_argument, 0, OPT_RECONNECT},
+        {"sniff", no_argument, 0, OPT_SNIFF},
+        {"trigger", required_argument, 0, OPT_TRIGGER},
+        {"trigger-log", required_argument, 0, OPT_TRIGGER_LOG},
+        {"trigger-pre", required_argument, 0, OPT_TRIGGER_PRE},
+        {"trigger-post", required_argument, 0, OPT_TRIGGER_POST},
+        {"timestamps", required_argument, 0, 't'},
         {0, 0, 0, 0}};
 
-    while ((opt = getopt_long(argc, argv, "hi:", long_options, nullptr)) != -1)
+    while ((opt = getopt_long(argc, argv, "hi:r:l:s:t:f:", long_options, nullptr)) != -1)
     {
         switch (opt)
         {
@@ -928,23 +6185,156 @@ int main(int argc, char **argv)
             print_usage(argv[0]);
             return 0;
         case 'i':
+            std::cout << "command string: " << optarg << std::endl;
             init_commands = parse_commands(optarg);
             break;
+        case 'r':
+            replay_file = optarg;
+            break;
+        case 'l':
+            log_file = optarg;
+            break;
+        case 's':
+            script_file = optarg;
+            break;
+        case OPT_SPEED:
+            replay_speed = atof(optarg);
+            if (replay_speed <= 0)
+            {
+                std::cerr << "Error: Invalid replay speed: " << optarg << std::endl;
+                return 1;
+            }
+            break;
+        case OPT_LOOP:
+            replay_loops = (unsigned)strtoul(optarg, nullptr, 10);
+            break;
+        case OPT_TX_WINDOW:
+            tx_window = strtol(optarg, nullptr, 10);
+            if (tx_window < 0 || tx_window > 255)
+            {
+                std::cerr << "Error: Invalid TX window (0-255): " << optarg << std::endl;
+                return 1;
+            }
+            break;
+        case OPT_STATS:
+            stats = true;
+            break;
+        case OPT_SNIFF:
+            sniff = true;
+            break;
+        case OPT_BENCH:
+            bench = true;
+            break;
+        case OPT_BENCH_TYPE:
+            if (strlen(optarg) != 1 || !strchr("tTdDbB", optarg[0]))
+            {
+                std::cerr << "Error: Invalid bench frame type: " << optarg << std::endl;
+                return 1;
+            }
+            bench_type = optarg[0];
+            break;
+        case OPT_BENCH_LEN:
+            bench_len = strtol(optarg, nullptr, 10);
+            if (bench_len < 0 || bench_len > 64)
+            {
+                std::cerr << "Error: Invalid bench length (0-64): " << optarg << std::endl;
+                return 1;
+            }
+            break;
+        case OPT_BENCH_RATE:
+            bench_rate = strtol(optarg, nullptr, 10);
+            if (bench_rate < 0)
+            {
+                std::cerr << "Error: Invalid bench rate: " << optarg << std::endl;
+                return 1;
+            }
+            break;
+        case OPT_BENCH_TIME:
+            bench_time = atof(optarg);
+            if (bench_time <= 0)
+            {
+                std::cerr << "Error: Invalid bench time: " << optarg << std::endl;
+                return 1;
+            }
+            break;
+        case OPT_ALL:
+            all_devices = true;
+            break;
+        case OPT_LOW_LATENCY:
+            low_latency = true;
+            break;
+        case OPT_READ_MODE:
+            if (strcmp(optarg, "event") != 0 && strcmp(optarg, "spin") != 0)
+            {
+                std::cerr << "Error: Invalid read mode (event or spin): " << optarg << std::endl;
+                return 1;
+            }
+            spin_reads = (strcmp(optarg, "spin") == 0);
+            break;
+        case 't':
+            if (strlen(optarg) != 1 || !strchr("azd", optarg[0]))
+            {
+                std::cerr << "Error: Invalid timestamp mode (a, z or d): " << optarg << std::endl;
+                return 1;
+            }
+            timestamp_mode = optarg[0];
+            break;
+        case OPT_SHM:
+            shm_name = optarg;
+            break;
+        case OPT_DBC:
+            dbc_file = optarg;
+            break;
+        case OPT_RECONNECT:
+            reconnect = true;
+            break;
+        case OPT_TRIGGER:
+            trigger_conditions.push_back(optarg);
+            break;
+        case OPT_TRIGGER_LOG:
+            trigger_log = optarg;
+            break;
+        case OPT_TRIGGER_PRE:
+            trigger_pre = strtol(optarg, nullptr, 10);
+            if (trigger_pre < 0 || trigger_pre > 1000000)
+            {
+                std::cerr << "Error: Invalid number of frames before the trigger (0-1000000): " << optarg << std::endl;
+                return 1;
+            }
+            break;
+        case OPT_TRIGGER_POST:
+            trigger_post = strtol(optarg, nullptr, 10);
+            if (trigger_post < 0 || trigger_post > 1000000)
+            {
+                std::cerr << "Error: Invalid number of frames after the trigger (0-1000000): " << optarg << std::endl;
+                return 1;
+            }
+            break;
+        case 'f':
+            if (!filter)
+            {
+                filter.reset(new FrameFilter());
+            }
+            if (!filter->add(optarg))
+            {
+                return 1;
+            }
+            break;
         default:
             print_usage(argv[0]);
             return 1;
         }
     }
 
-    std::string tty;
+    std::vector<std::string> ttys(argv + optind, argv + argc);
 
-    if (optind >= argc)
+    if (ttys.empty())
     {
-        // No TTY specified, try to find one
+        // No TTY specified, try to find one or all of them
         std::cout << "No TTY device specified, searching for SLCAN device..." << std::endl;
-        tty = find_slcan_device();
+        std::vector<std::string> found = find_slcan_devices();
 
-        if (tty.empty())
+        if (found.empty())
         {
             std::cerr << "Error: No SLCAN device found in /dev\n"
                       << std::endl;
@@ -954,18 +6344,90 @@ int main(int argc, char **argv)
             return 1;
         }
 
-        std::cout << "Found SLCAN device: " << tty << std::endl;
+        ttys.assign(found.begin(), all_devices ? found.end() : found.begin() + 1);
+        for (size_t i = 0; i < ttys.size(); i++)
+        {
+            std::cout << "Found SLCAN device: " << ttys[i] << std::endl;
+        }
     }
-    else
+    else if (all_devices)
+    {
+        std::cerr << "Error: --all cannot be combined with device arguments" << std::endl;
+        return 1;
+    }
+
+    if (ttys.size() > SlcanTerminal::MAX_CHANNELS)
+    {
+        std::cerr << "Error: At most " << SlcanTerminal::MAX_CHANNELS << " adapters are supported" << std::endl;
+        return 1;
+    }
+
+    SlcanTerminal terminal(ttys);
+    terminal.set_tx_window((unsigned)tx_window);
+    terminal.set_low_latency(low_latency);
+    terminal.set_spin_reads(spin_reads);
+    terminal.set_timestamp_mode(timestamp_mode);
+    if (reconnect)
+    {
+        terminal.set_reconnect(init_commands);
+    }
+    if (filter)
+    {
+        filter->compile();
+        terminal.set_filter(std::move(filter));
+    }
+    if (sniff)
+    {
+        terminal.enable_sniff();
+    }
+    else if (stats)
+    {
+        terminal.enable_stats();
+    }
+
+    if (!dbc_file.empty() && !terminal.load_dbc(dbc_file))
+    {
+        return 1;
+    }
+
+    // Pre-encode the whole replay log before touching the device
+    if (!replay_file.empty() && !terminal.load_replay(replay_file))
+    {
+        return 1;
+    }
+
+    // Commands from a pipe or file instead of the interactive prompt
+    int script_fd = -1;
+    if (replay_file.empty() && !bench && script_file.empty() && !isatty(STDIN_FILENO))
+    {
+        script_file = "-";
+    }
+    if (!script_file.empty())
     {
-        tty = argv[optind];
+        script_fd = (script_file == "-") ? STDIN_FILENO : open(script_file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (script_fd < 0)
+        {
+            perror(script_file.c_str());
+            return 1;
+        }
     }
 
-    SlcanTerminal terminal(tty);
+    if (!terminal.open_devices())
+    {
+        return 1;
+    }
 
-    if (!terminal.open_device())
+    if (!log_file.empty() && !terminal.open_capture_log(log_file))
+    {
+        return 1;
+    }
+    if (!shm_name.empty() && !terminal.open_shm(shm_name))
+    {
+        return 1;
+    }
+    if (!trigger_conditions.empty() &&
+        !terminal.open_trigger(trigger_conditions, trigger_log, (size_t)trigger_pre, (size_t)trigger_post))
     {
-        std::cerr << "Failed to open device: " << tty << std::endl;
         return 1;
     }
 
@@ -975,7 +6437,37 @@ int main(int argc, char **argv)
         terminal.send_init_commands(init_commands);
     }
 
-    terminal.run_terminal();
+    // Ctrl+C and kill end the session cleanly, restoring the terminal settings.
+    // No SA_RESTART, so a blocking read() of stdin returns with EINTR.
+    signal_terminal = &terminal;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    if (!replay_file.empty())
+    {
+        terminal.run_replay(replay_speed, replay_loops);
+    }
+    else if (bench)
+    {
+        terminal.run_bench(bench_type, (unsigned)bench_len, (unsigned)bench_rate, bench_time);
+    }
+    else if (script_fd >= 0)
+    {
+        terminal.run_script(script_fd, script_file == "-" ? "stdin" : script_file);
+        if (script_fd != STDIN_FILENO)
+        {
+            close(script_fd);
+        }
+    }
+    else
+    {
+        terminal.run_terminal();
+    }
 
+    signal_terminal = nullptr;
     return 0;
 }